@@ -0,0 +1,208 @@
+// Attach throughput of the loader against mock inspectors, on Linux without
+// any Electron app around.
+//
+// Every simulated launch spawns this executable again as a mock node process
+// (see mock_inspector.cpp) and hands its pid to Loader::process_application,
+// the same call the loader's workers make. Latency counts from the spawn
+// until process_application returns, so it includes the mock's boot delay
+// and waiting for the port lease. CPU is this process' own: the loader, its
+// CDP loop and the service threads around them, not the mocks.
+
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/config.hpp"
+#include "../src/filecache.hpp"
+#include "../src/log.hpp"
+#include "../src/service/service.hpp"
+#include "mock_inspector.hpp"
+
+#define MOCK_EXECUTABLE "mock-electron"
+#define MOCK_ARG "--mock-inspector"
+
+extern char** environ;
+
+namespace {
+  double cpu_seconds(int who) {
+    rusage usage;
+    getrusage(who, &usage);
+    auto seconds = [](const timeval& t) {
+      return static_cast<double>(t.tv_sec) + t.tv_usec / 1e6;
+    };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+  }
+
+  pid_t spawn_mock(const MockInspectorOptions& options) {
+    std::vector<std::string> args = {MOCK_EXECUTABLE, MOCK_ARG};
+    for (auto& arg : options.to_args()) args.push_back(arg);
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv.data(),
+                    environ) != 0)
+      throw std::runtime_error("posix_spawn failed: " +
+                               std::string(strerror(errno)));
+    return pid;
+  }
+
+  // a config directory with the one application the mocks pretend to be
+  std::filesystem::path write_config(bool codeCache, size_t scriptSize) {
+    auto dir = std::filesystem::temp_directory_path() /
+               std::format("electrotheme-attach-bench-{}", getpid());
+    std::filesystem::create_directories(dir / "scripts" / "mock");
+    nlohmann::json app = {{"name", MOCK_EXECUTABLE}, {"directory", "mock"}};
+    if (codeCache) app["injectionMode"] = "codeCache";
+    // the loader reports every attach at info
+    std::ofstream(dir / "config.json")
+        << nlohmann::json({{"logLevel", "warn"}, {"applications", {app}}})
+               .dump();
+    if (scriptSize > 0)
+      std::ofstream(dir / "scripts" / "mock" / "index.js")
+          << "globalThis.__bench = '" << std::string(scriptSize, 'x')
+          << "'\n";
+    return dir;
+  }
+
+  double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    auto i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+  }
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], MOCK_ARG) == 0)
+    return run_mock_inspector(
+        MockInspectorOptions::from_args(argv + 2, argc - 2));
+
+  int attaches = 100;
+  unsigned int concurrency = 4;
+  bool codeCache = false;
+  size_t scriptSize = 0;
+  int bootDelay = 20, listenDelay = 5, evaluateLatency = 10, replySize = 256;
+  MockInspectorOptions mock;
+
+  CLI::App app{"Loader attach benchmark against mock inspectors",
+               "attach_bench"};
+  app.add_option("-n,--attaches", attaches, "Simulated process launches");
+  app.add_option("-c,--concurrency", concurrency,
+                 "Launches in flight, like loaderWorkers");
+  app.add_flag("--code-cache", codeCache, "Use the codeCache injection mode");
+  app.add_option("--script-size", scriptSize,
+                 "Bytes of application script to inject besides the bundle");
+  app.add_option("--boot-delay", bootDelay,
+                 "ms until the mock installs its SIGUSR1 handler");
+  app.add_option("--listen-delay", listenDelay,
+                 "ms from SIGUSR1 until the mock inspector listens");
+  app.add_option("--list-retries", mock.listRetries,
+                 "/json/list answers without targets before the real one");
+  app.add_option("--evaluate-latency", evaluateLatency,
+                 "ms before each Runtime.evaluate reply");
+  app.add_option("--reply-size", replySize,
+                 "Bytes of each Runtime.evaluate result");
+  CLI11_PARSE(app, argc, argv);
+  mock.bootDelay = std::chrono::milliseconds(bootDelay);
+  mock.listenDelay = std::chrono::milliseconds(listenDelay);
+  mock.evaluateLatency = std::chrono::milliseconds(evaluateLatency);
+  mock.replySize = static_cast<size_t>(replySize);
+
+  auto configDir = write_config(codeCache, scriptSize).string();
+  gConfig = std::make_unique<Config>();
+  gConfig->set_config_directory(configDir);
+  gConfig->load_file(true);
+  gFileCache = std::make_unique<FileCache>();
+  // the payloads carry the server's port
+  gService = std::make_unique<Service>();
+  gService->server = std::make_unique<Server>();
+  if (!gService->server->listening().get()) {
+    fprintf(stderr, "The server didn't start\n");
+    return 1;
+  }
+
+  // its worker idles, the benchmark threads call process_application
+  // themselves. Never destroyed, like the service's.
+  auto loader = new Loader(1);
+
+  std::mutex m;
+  std::vector<double> latencies;
+  std::atomic<int> next = 0;
+  std::atomic<int> failed = 0;
+
+  auto cpuBefore = cpu_seconds(RUSAGE_SELF);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < std::max(concurrency, 1u); ++t) {
+    threads.emplace_back([&] {
+      while (next++ < attaches) {
+        auto launched = std::chrono::steady_clock::now();
+        auto pid = spawn_mock(mock);
+        LoaderApplication target = {
+            .processId = static_cast<uint32_t>(pid),
+            .executableName = MOCK_EXECUTABLE,
+            .removeCSP = false,
+            .attach = {},
+            .injectionMode = codeCache ? InjectionMode::CodeCache
+                                       : InjectionMode::Evaluate,
+            .enqueuedAt = launched};
+        try {
+          loader->process_application(target);
+          auto ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - launched)
+                        .count();
+          std::lock_guard<std::mutex> lock(m);
+          latencies.push_back(ms);
+        } catch (const std::exception& ex) {
+          fprintf(stderr, "attach to %d failed: %s\n", pid, ex.what());
+          failed++;
+          kill(pid, SIGKILL);
+        }
+        waitpid(pid, nullptr, 0);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  auto seconds = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  auto cpu = cpu_seconds(RUSAGE_SELF) - cpuBefore;
+  auto mockCpu = cpu_seconds(RUSAGE_CHILDREN);
+
+  std::sort(latencies.begin(), latencies.end());
+  auto succeeded = latencies.size();
+  printf("%d attaches (%d failed), %u in flight, %s mode\n", attaches,
+         failed.load(), concurrency, codeCache ? "codeCache" : "evaluate");
+  printf("  throughput  %8.1f attaches/s\n", succeeded / seconds);
+  printf("  latency     %8.1f ms p50 %8.1f ms p99 %8.1f ms max\n",
+         percentile(latencies, 0.5), percentile(latencies, 0.99),
+         latencies.empty() ? 0.0 : latencies.back());
+  printf("  loader CPU  %8.2f ms per attach\n",
+         succeeded ? cpu * 1000 / succeeded : 0.0);
+  printf("  mock CPU    %8.2f ms per attach\n",
+         succeeded ? mockCpu * 1000 / succeeded : 0.0);
+  fflush(stdout);
+
+  std::error_code ec;
+  std::filesystem::remove_all(configDir, ec);
+  // the service's threads never stop, skip destroying what they use
+  Logger::instance().flush();
+  _exit(failed > 0 ? 1 : 0);
+}
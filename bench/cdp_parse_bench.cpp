@@ -0,0 +1,145 @@
+// Compares the inspector receive path before and after CdpReceiveBuffer +
+// parse_cdp_message: allocations, bytes copied and time per message.
+//
+// Frames are fed the way curl_ws_recv hands them out, in RECV_CHUNK_SIZE
+// pieces for the old path and in one piece once the frame length is known
+// for the new one. The copy out of curl's own buffer is the same for both
+// and not counted.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "../src/service/cdpmessage.hpp"
+
+#define RECV_CHUNK_SIZE 16384
+
+namespace {
+  std::atomic<size_t> allocations = 0;
+  std::atomic<size_t> allocatedBytes = 0;
+}  // namespace
+
+void* operator new(size_t n) {
+  allocations++;
+  allocatedBytes += n;
+  if (auto p = malloc(n)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+namespace {
+  struct Result {
+    size_t allocations;
+    size_t allocatedBytes;
+    size_t copiedBytes;
+    double nsPerMessage;
+  };
+
+  // An evaluate reply with a result of roughly size bytes
+  std::string make_reply(int id, size_t size) {
+    nlohmann::json value = nlohmann::json::array();
+    std::string item(64, 'x');
+    for (size_t i = 0; i < size / 70 + 1; ++i) value.push_back(item);
+    return nlohmann::json({{"id", id},
+                           {"result",
+                            {{"result", {{"type", "object"}, {"value", value}}}}}})
+        .dump();
+  }
+
+  // Inspector::poll() + parseMessage() as they were: a new[] sized for the
+  // rest of the frame per fragment, appending to the frame vector, a copy
+  // into a std::string and a full DOM
+  int old_path(const std::string& frame, size_t& copied) {
+    std::vector<char> q;
+    for (size_t offset = 0; offset < frame.size(); offset += RECV_CHUNK_SIZE) {
+      auto rlen = std::min<size_t>(RECV_CHUNK_SIZE, frame.size() - offset);
+      char* buf = new char[frame.size() - offset];
+      memcpy(buf, frame.data() + offset, rlen);  // curl's copy
+
+      auto before = q.capacity();
+      q.insert(q.end(), buf, buf + rlen);
+      copied += rlen;
+      if (q.capacity() != before) copied += q.size() - rlen;  // regrowth
+      delete[] buf;
+    }
+    std::string msg(q.data(), q.size());
+    copied += msg.size();
+    auto p = nlohmann::json::parse(msg);
+    return p["id"].get<int>();
+  }
+
+  int new_path(const std::string& frame, CdpReceiveBuffer& buffer,
+               size_t& copied) {
+    size_t frameBytesLeft = 0;
+    size_t offset = 0;
+    while (offset < frame.size()) {
+      auto want = std::max<size_t>(frameBytesLeft, RECV_CHUNK_SIZE);
+      auto before = buffer.capacity();
+      auto dst = buffer.prepare(want);
+      if (buffer.capacity() != before) copied += buffer.size();  // regrowth
+
+      auto rlen = std::min(want, frame.size() - offset);
+      memcpy(dst, frame.data() + offset, rlen);  // curl's copy
+      buffer.commit(rlen);
+      offset += rlen;
+      frameBytesLeft = frame.size() - offset;
+    }
+    CdpMessage msg;
+    parse_cdp_message(buffer.view(), msg);
+    buffer.clear();
+    return msg.id;
+  }
+
+  template <typename Fn>
+  Result measure(int iterations, Fn fn) {
+    size_t copied = 0;
+    fn(copied);  // warm up
+
+    copied = 0;
+    auto a0 = allocations.load();
+    auto b0 = allocatedBytes.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) fn(copied);
+    auto ns = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    return {(allocations - a0) / iterations,
+            (allocatedBytes - b0) / iterations, copied / iterations,
+            ns / iterations};
+  }
+
+  void print(const char* name, const Result& r) {
+    printf("  %-4s %8zu allocs %12zu B allocated %12zu B copied %12.0f ns\n",
+           name, r.allocations, r.allocatedBytes, r.copiedBytes,
+           r.nsPerMessage);
+  }
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 50;
+
+  for (size_t size : {256, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024}) {
+    auto frame = make_reply(7, size);
+    printf("reply of %zu bytes, per message (%d iterations)\n", frame.size(),
+           iterations);
+
+    print("old", measure(iterations, [&](size_t& copied) {
+            if (old_path(frame, copied) != 7) abort();
+          }));
+
+    CdpReceiveBuffer buffer;
+    print("new", measure(iterations, [&](size_t& copied) {
+            if (new_path(frame, buffer, copied) != 7) abort();
+          }));
+  }
+}
@@ -0,0 +1,362 @@
+// A node process as far as the loader can tell on Linux: a caught SIGUSR1,
+// then an inspector listening on a port of the process that lists one target
+// and speaks just enough CDP over a WebSocket for Runtime.enable and
+// Runtime.evaluate. Everything runs on the one thread, one connection at a
+// time, which is how the loader talks to it anyway.
+
+#include "mock_inspector.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+using json = nlohmann::json;
+
+namespace {
+  // SHA-1 (RFC 3174), only for Sec-WebSocket-Accept
+  std::array<uint8_t, 20> sha1(std::string_view data) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                     0xC3D2E1F0};
+    auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+    std::string msg(data);
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    msg += static_cast<char>(0x80);
+    while (msg.size() % 64 != 56) msg += '\0';
+    for (int i = 7; i >= 0; --i) msg += static_cast<char>(bits >> (i * 8));
+
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+      uint32_t w[80];
+      for (int i = 0; i < 16; ++i) {
+        auto p = reinterpret_cast<const uint8_t*>(msg.data() + chunk + i * 4);
+        w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+               (uint32_t(p[2]) << 8) | p[3];
+      }
+      for (int i = 16; i < 80; ++i)
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+      uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+      for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+          f = (b & c) | (~b & d);
+          k = 0x5A827999;
+        } else if (i < 40) {
+          f = b ^ c ^ d;
+          k = 0x6ED9EBA1;
+        } else if (i < 60) {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8F1BBCDC;
+        } else {
+          f = b ^ c ^ d;
+          k = 0xCA62C1D6;
+        }
+        auto t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+      }
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+    }
+
+    std::array<uint8_t, 20> out;
+    for (int i = 0; i < 20; ++i) out[i] = h[i / 4] >> (24 - (i % 4) * 8);
+    return out;
+  }
+
+  std::string base64(const uint8_t* data, size_t size) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < size; i += 3) {
+      uint32_t n = data[i] << 16;
+      if (i + 1 < size) n |= data[i + 1] << 8;
+      if (i + 2 < size) n |= data[i + 2];
+      out += alphabet[(n >> 18) & 63];
+      out += alphabet[(n >> 12) & 63];
+      out += i + 1 < size ? alphabet[(n >> 6) & 63] : '=';
+      out += i + 2 < size ? alphabet[n & 63] : '=';
+    }
+    return out;
+  }
+
+  bool send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+      auto n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      data.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
+  }
+
+  bool recv_exact(int fd, char* out, size_t size) {
+    while (size > 0) {
+      auto n = recv(fd, out, size, 0);
+      if (n <= 0) return false;
+      out += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  // the request line and headers, empty if the peer went away first
+  std::string recv_request(int fd) {
+    std::string request;
+    char buf[4096];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      auto n = recv(fd, buf, sizeof buf, 0);
+      if (n <= 0) return "";
+      request.append(buf, static_cast<size_t>(n));
+    }
+    return request;
+  }
+
+  std::string header_value(const std::string& request, std::string_view name) {
+    for (size_t at = request.find("\r\n"); at != std::string::npos;) {
+      auto end = request.find("\r\n", at + 2);
+      if (end == std::string::npos) break;
+      std::string_view line(request.data() + at + 2, end - at - 2);
+      at = end;
+      if (line.size() <= name.size() || line[name.size()] != ':' ||
+          strncasecmp(line.data(), name.data(), name.size()) != 0)
+        continue;
+      line.remove_prefix(name.size() + 1);
+      while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+      return std::string(line);
+    }
+    return "";
+  }
+
+  bool send_frame(int fd, int opcode, std::string_view payload) {
+    // server frames aren't masked
+    std::string header;
+    header += static_cast<char>(0x80 | opcode);
+    if (payload.size() < 126) {
+      header += static_cast<char>(payload.size());
+    } else if (payload.size() <= 0xFFFF) {
+      header += static_cast<char>(126);
+      header += static_cast<char>(payload.size() >> 8);
+      header += static_cast<char>(payload.size());
+    } else {
+      header += static_cast<char>(127);
+      for (int i = 7; i >= 0; --i)
+        header += static_cast<char>(uint64_t(payload.size()) >> (i * 8));
+    }
+    return send_all(fd, header) && send_all(fd, payload);
+  }
+
+  // one whole message, continuation frames included. False once the peer is
+  // gone or closes.
+  bool recv_message(int fd, int& opcode, std::string& payload) {
+    payload.clear();
+    while (true) {
+      uint8_t head[2];
+      if (!recv_exact(fd, reinterpret_cast<char*>(head), 2)) return false;
+      bool fin = head[0] & 0x80;
+      if ((head[0] & 0x0F) != 0) opcode = head[0] & 0x0F;
+
+      uint64_t length = head[1] & 0x7F;
+      if (length >= 126) {
+        uint8_t ext[8];
+        size_t extSize = length == 126 ? 2 : 8;
+        if (!recv_exact(fd, reinterpret_cast<char*>(ext), extSize))
+          return false;
+        length = 0;
+        for (size_t i = 0; i < extSize; ++i) length = (length << 8) | ext[i];
+      }
+      uint8_t mask[4] = {};
+      if ((head[1] & 0x80) &&
+          !recv_exact(fd, reinterpret_cast<char*>(mask), 4))
+        return false;
+
+      auto offset = payload.size();
+      payload.resize(offset + length);
+      if (!recv_exact(fd, payload.data() + offset, length)) return false;
+      for (uint64_t i = 0; i < length; ++i) payload[offset + i] ^= mask[i % 4];
+
+      if (opcode == WS_OPCODE_CLOSE) return false;
+      if (opcode == WS_OPCODE_PING) {
+        send_frame(fd, WS_OPCODE_PONG, payload);
+        payload.clear();
+        continue;
+      }
+      if (fin) return true;
+    }
+  }
+
+  std::string evaluate_result(const std::string& expression,
+                              const MockInspectorOptions& options) {
+    // the loader's version query in code cache mode
+    if (expression.starts_with("process.versions"))
+      return json({{"result", {{"type", "string"}, {"value", "mock-1.0"}}}})
+          .dump();
+    // an object, like the code cache wrapper returns by value
+    return json({{"result",
+                  {{"type", "object"},
+                   {"value", {{"pad", std::string(options.replySize, 'x')}}}}}})
+        .dump();
+  }
+
+  // true once process._debugEnd() was evaluated
+  bool serve_session(int fd, const MockInspectorOptions& options) {
+    int opcode = 0;
+    std::string message;
+    while (recv_message(fd, opcode, message)) {
+      if (opcode != WS_OPCODE_TEXT) continue;
+      auto command = json::parse(message, nullptr, false);
+      if (!command.is_object() || !command.contains("id")) continue;
+      auto id = command["id"].get<int>();
+      auto method = command.value("method", "");
+
+      if (method != "Runtime.evaluate") {
+        if (!send_frame(fd, WS_OPCODE_TEXT,
+                        std::format("{{\"id\":{},\"result\":{{}}}}", id)))
+          return false;
+        continue;
+      }
+
+      auto expression =
+          command["params"].value("expression", std::string());
+      std::this_thread::sleep_for(options.evaluateLatency);
+      if (!send_frame(fd, WS_OPCODE_TEXT,
+                      std::format("{{\"id\":{},\"result\":{}}}", id,
+                                  evaluate_result(expression, options))))
+        return false;
+
+      // the bundle ends with it, or it comes on its own in code cache mode
+      if (expression.ends_with("process._debugEnd();") ||
+          expression == "process._debugEnd()")
+        return true;
+    }
+    return false;
+  }
+
+  void sleep_ms(std::chrono::milliseconds ms) {
+    if (ms.count() > 0) std::this_thread::sleep_for(ms);
+  }
+}  // namespace
+
+std::vector<std::string> mock_inspector_options_t::to_args() const {
+  return {std::to_string(bootDelay.count()),
+          std::to_string(listenDelay.count()), std::to_string(listRetries),
+          std::to_string(evaluateLatency.count()), std::to_string(replySize)};
+}
+
+mock_inspector_options_t mock_inspector_options_t::from_args(char** args,
+                                                             int count) {
+  MockInspectorOptions options;
+  if (count < 5) return options;
+  options.bootDelay = std::chrono::milliseconds(atoi(args[0]));
+  options.listenDelay = std::chrono::milliseconds(atoi(args[1]));
+  options.listRetries = atoi(args[2]);
+  options.evaluateLatency = std::chrono::milliseconds(atoi(args[3]));
+  options.replySize = static_cast<size_t>(atoll(args[4]));
+  return options;
+}
+
+int run_mock_inspector(const MockInspectorOptions& options) {
+  // the benchmark's sockets (the loader's connections to other mocks) would
+  // otherwise show up as ours
+  close_range(3, ~0U, 0);
+
+  // held pending for sigwait(), the handler only makes SIGUSR1 show as
+  // caught in /proc/<pid>/status
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &usr1, nullptr);
+
+  sleep_ms(options.bootDelay);
+  struct sigaction action {};
+  action.sa_handler = [](int) {};
+  sigaction(SIGUSR1, &action, nullptr);
+  int signal;
+  sigwait(&usr1, &signal);
+
+  sleep_ms(options.listenDelay);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;  // node would take 9229, the loader finds either
+  socklen_t addrLen = sizeof addr;
+  if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 ||
+      listen(listener, 16) != 0 ||
+      getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addrLen) !=
+          0)
+    return 1;
+  auto port = ntohs(addr.sin_port);
+
+  int listed = 0;
+  while (true) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) return 1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    auto request = recv_request(fd);
+    if (request.starts_with("GET /json/list")) {
+      auto body =
+          listed++ < options.listRetries
+              ? std::string("[]")
+              : json::array({{{"webSocketDebuggerUrl",
+                               std::format("ws://127.0.0.1:{}/mock", port)}}})
+                    .dump();
+      send_all(fd, std::format("HTTP/1.1 200 OK\r\nContent-Type: "
+                               "application/json\r\nContent-Length: {}\r\n"
+                               "Connection: close\r\n\r\n{}",
+                               body.size(), body));
+      close(fd);
+      continue;
+    }
+
+    auto key = header_value(request, "Sec-WebSocket-Key");
+    if (key.empty()) {
+      send_all(fd,
+               "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+               "Connection: close\r\n\r\n");
+      close(fd);
+      continue;
+    }
+    auto digest = sha1(key + WS_GUID);
+    send_all(fd, std::format("HTTP/1.1 101 Switching Protocols\r\n"
+                             "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                             "Sec-WebSocket-Accept: {}\r\n\r\n",
+                             base64(digest.data(), digest.size())));
+
+    auto ended = serve_session(fd, options);
+    if (ended) {
+      // node stops listening, then drops the session
+      close(listener);
+      send_frame(fd, WS_OPCODE_CLOSE, "");
+      close(fd);
+      return 0;
+    }
+    close(fd);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef BENCH_MOCK_INSPECTOR_HPP
+#define BENCH_MOCK_INSPECTOR_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// How the stand-in for a node process behaves, each delay counts from the
+// previous step
+typedef struct mock_inspector_options_t {
+  // until the SIGUSR1 handler is installed, node starting up
+  std::chrono::milliseconds bootDelay{20};
+  // from SIGUSR1 until the inspector listens
+  std::chrono::milliseconds listenDelay{5};
+  // /json/list answers without targets this many times first
+  int listRetries = 1;
+  // before each Runtime.evaluate reply
+  std::chrono::milliseconds evaluateLatency{10};
+  // of each Runtime.evaluate result value
+  size_t replySize = 256;
+
+  // to pass the options on to the child process and back
+  std::vector<std::string> to_args() const;
+  static mock_inspector_options_t from_args(char** args, int count);
+} MockInspectorOptions;
+
+// Runs as a child process of the benchmark. Waits for SIGUSR1 the way node
+// does, then serves /json/list and one CDP WebSocket on 127.0.0.1 until
+// process._debugEnd() is evaluated. Returns the exit code.
+int run_mock_inspector(const MockInspectorOptions& options);
+
+#endif /* BENCH_MOCK_INSPECTOR_HPP */
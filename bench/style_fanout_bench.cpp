@@ -0,0 +1,703 @@
+// Fan-out of style updates to many /client subscribers: a Server in a child
+// process, N WebSocket clients spread over M executables in this one.
+//
+// The child applies an update whenever this process asks for one over a
+// pipe, and a client's latency for a version runs from the time it was asked
+// until the client has decoded the message carrying it. Clients behave like
+// the injected bundle: HELLO, then a RESYNC whenever a delta doesn't apply to
+// the version they have. Versions a client never saw (publishes skipped over
+// backpressure) are reported as skipped. Server memory is the child's VmRSS,
+// sampled while the updates go out, its CPU counts all of its loops.
+// For scaling across cores, sweep --server-workers with enough --threads
+// that the clients, on the same machine, aren't what saturates.
+//
+// The clients offer permessage-deflate, so --compression applies to the JSON
+// protocol (--json). Binary style frames are deflated by the StyleStore
+// whatever the setting. With --shared, clients read whole stylesheets from
+// shared memory like the bundle does (PROTOCOL_SHARED), the bytes they read
+// count as received.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../src/config.hpp"
+#include "../src/filecache.hpp"
+#include "../src/service/protocol.hpp"
+#include "../src/service/server.hpp"
+#include "../src/stylebundler.hpp"
+
+#define SERVER_ARG "--server"
+#define WS_OPCODE_CONT 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+#define WS_FLAG_RSV1 0x40
+// without news from any client for this long after the last update, the
+// rest isn't coming
+#define SETTLE_TIMEOUT std::chrono::seconds(2)
+
+using json = nlohmann::json;
+
+extern char** environ;
+
+namespace {
+  using steady = std::chrono::steady_clock;
+
+  int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               steady::now().time_since_epoch())
+        .count();
+  }
+
+  std::string exe_name(int i) { return std::format("bench-{}", i); }
+
+  std::string make_css(size_t size) {
+    std::string css;
+    for (int i = 0; css.size() < size; ++i)
+      css += std::format(
+          ".c{} > .item:hover {{ color: #{:06x}; margin: {}px 0; }}\n", i,
+          (i * 2654435761u) & 0xFFFFFF, i % 13);
+    css.resize(size);
+    return css;
+  }
+
+  // Rewrites edit bytes of css at a spot that moves with seq, or all of it
+  // if edit is 0. Edits accumulate, so consecutive versions only differ by
+  // one of them.
+  void apply_edit(std::string& css, size_t edit, uint64_t seq) {
+    auto filler = std::format("/*{:x}*/", seq);
+    if (edit == 0 || edit >= css.size()) {
+      for (size_t i = 0; i < css.size(); ++i)
+        css[i] = filler[(i + seq) % filler.size()];
+      return;
+    }
+    auto at = (seq * 7919) % (css.size() - edit + 1);
+    for (size_t i = 0; i < edit; ++i) css[at + i] = filler[i % filler.size()];
+  }
+
+  // The child: a Server for executables applications, applying an update
+  // to the stylesheet of the executable on each line of stdin
+  int run_server(int executables, size_t size, size_t edit,
+                 ServerOptions options) {
+    auto dir = std::filesystem::temp_directory_path() /
+               std::format("electrotheme-fanout-bench-{}", getpid());
+    std::filesystem::create_directories(dir);
+    json apps = json::array();
+    for (int i = 0; i < executables; ++i)
+      apps.push_back({{"name", exe_name(i)}, {"directory", exe_name(i)}});
+    std::ofstream(dir / "config.json")
+        << json({{"logLevel", "warn"}, {"applications", apps}}).dump();
+
+    auto dirString = dir.string();
+    gConfig = std::make_unique<Config>();
+    gConfig->set_config_directory(dirString);
+    gConfig->load_file(true);
+    gFileCache = std::make_unique<FileCache>();
+    gBundler = std::make_unique<StyleBundler>();
+
+    // what clients get on HELLO
+    std::vector<std::string> css(executables, make_css(size));
+    std::vector<uint64_t> seq(executables, 0);
+    for (int i = 0; i < executables; ++i)
+      std::ofstream(gConfig->styles_directory / exe_name(i) / "index.css",
+                    std::ios::binary)
+          << css[i];
+
+    auto server = new Server(options);
+    if (!server->listening().get()) return 1;
+    printf("port %d\n", server->port.load());
+    fflush(stdout);
+
+    std::string line;
+    while (std::getline(std::cin, line) && line != "quit") {
+      auto i = atoi(line.c_str());
+      if (i < 0 || i >= executables) continue;
+      apply_edit(css[i], edit, ++seq[i]);
+      auto name = exe_name(i);
+      server->update_style(name, css[i]);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    // the server threads never stop, skip destroying what they use
+    fflush(stdout);
+    _exit(0);
+  }
+
+  typedef struct server_process_t {
+    pid_t pid;
+    FILE* in;
+    FILE* out;
+  } ServerProcess;
+
+  ServerProcess spawn_server(std::vector<std::string> args) {
+    int toChild[2], fromChild[2];
+    if (pipe2(toChild, O_CLOEXEC) != 0 || pipe2(fromChild, O_CLOEXEC) != 0)
+      throw std::runtime_error("pipe2 failed");
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, toChild[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fromChild[1], STDOUT_FILENO);
+
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    pid_t pid;
+    auto res = posix_spawn(&pid, "/proc/self/exe", &actions, nullptr,
+                           argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(toChild[0]);
+    close(fromChild[1]);
+    if (res != 0) throw std::runtime_error("posix_spawn failed");
+    return {pid, fdopen(toChild[1], "w"), fdopen(fromChild[0], "r")};
+  }
+
+  // from /proc/<pid>/status, in bytes
+  size_t resident_bytes(pid_t pid) {
+    std::ifstream ifs(std::format("/proc/{}/status", pid));
+    std::string line;
+    while (std::getline(ifs, line))
+      if (line.starts_with("VmRSS:"))
+        return std::stoull(line.substr(6)) * 1024;
+    return 0;
+  }
+
+  // user + system time from /proc/<pid>/stat
+  double cpu_seconds(pid_t pid) {
+    std::ifstream ifs(std::format("/proc/{}/stat", pid));
+    std::string stat((std::istreambuf_iterator<char>(ifs)), {});
+    // the command may contain spaces, count fields after it
+    auto fields = std::string_view(stat).substr(stat.rfind(')') + 2);
+    unsigned long long utime = 0, stime = 0;
+    // state ppid pgrp session tty tpgid flags minflt cminflt majflt cmajflt
+    // utime stime
+    sscanf(std::string(fields).c_str(),
+           "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime,
+           &stime);
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+  }
+
+  // A /client connection speaking just enough WebSocket: masked frames out,
+  // permessage-deflate in
+  class Client {
+   public:
+    int exe;
+    // written by the client's receiver thread, read by the main thread
+    std::atomic<uint64_t> version = 0;
+
+    Client(int exe) : exe(exe) {
+      inflater.zalloc = Z_NULL;
+      inflater.zfree = Z_NULL;
+      inflater.opaque = Z_NULL;
+      inflateInit2(&inflater, -MAX_WBITS);
+    }
+    ~Client() {
+      inflateEnd(&inflater);
+      if (fd >= 0) close(fd);
+    }
+
+    // blocking handshake, then the socket is non-blocking
+    bool connect(int port) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(static_cast<uint16_t>(port));
+      if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+        return false;
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+      auto request = std::format(
+          "GET /client HTTP/1.1\r\nHost: 127.0.0.1:{}\r\n"
+          "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+          "Sec-WebSocket-Version: 13\r\n"
+          "Sec-WebSocket-Extensions: permessage-deflate; "
+          "client_max_window_bits\r\n\r\n",
+          port);
+      if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+          static_cast<ssize_t>(request.size()))
+        return false;
+
+      char buf[4096];
+      size_t end;
+      while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+        auto n = recv(fd, buf, sizeof buf, 0);
+        if (n <= 0) return false;
+        in.append(buf, static_cast<size_t>(n));
+      }
+      if (!in.starts_with("HTTP/1.1 101")) return false;
+      // frames may have come along with the response
+      in.erase(0, end + 4);
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      return true;
+    }
+
+    int socket_fd() const { return fd; }
+
+    void send_text(std::string_view text) {
+      send_frame(WS_OPCODE_TEXT, text);
+    }
+
+    // Reads whatever arrived and calls onMessage(opcode, payload) for every
+    // whole message. False once the connection is gone.
+    template <typename Fn>
+    bool receive(Fn onMessage) {
+      char buf[65536];
+      while (true) {
+        auto n = recv(fd, buf, sizeof buf, 0);
+        if (n > 0) {
+          in.append(buf, static_cast<size_t>(n));
+          continue;
+        }
+        if (n == 0) return false;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno != EINTR) return false;
+      }
+
+      size_t at = 0;
+      while (in.size() - at >= 2) {
+        auto p = reinterpret_cast<const uint8_t*>(in.data() + at);
+        auto available = in.size() - at;
+        size_t header = 2;
+        uint64_t length = p[1] & 0x7F;
+        if (length == 126) {
+          if (available < 4) break;
+          length = (uint64_t(p[2]) << 8) | p[3];
+          header = 4;
+        } else if (length == 127) {
+          if (available < 10) break;
+          length = 0;
+          for (int i = 0; i < 8; ++i) length = (length << 8) | p[2 + i];
+          header = 10;
+        }
+        if (available < header + length) break;
+
+        int opcode = p[0] & 0x0F;
+        bool fin = p[0] & 0x80;
+        std::string_view payload(in.data() + at + header, length);
+        at += header + length;
+
+        if (opcode == WS_OPCODE_CLOSE) return false;
+        if (opcode == WS_OPCODE_PING) {
+          send_frame(WS_OPCODE_PONG, payload);
+          continue;
+        }
+        if (opcode == WS_OPCODE_PONG) continue;
+        if (opcode != WS_OPCODE_CONT) {
+          messageOpcode = opcode;
+          compressed = p[0] & WS_FLAG_RSV1;
+          message.clear();
+        }
+        message.append(payload);
+        if (!fin) continue;
+
+        if (compressed) {
+          if (!inflate_message()) return false;
+          onMessage(messageOpcode, std::string_view(inflated));
+        } else {
+          onMessage(messageOpcode, std::string_view(message));
+        }
+      }
+      in.erase(0, at);
+      return true;
+    }
+
+   private:
+    int fd = -1;
+    std::string in;
+    std::string message;
+    int messageOpcode = 0;
+    bool compressed = false;
+    z_stream inflater;
+    std::string inflated;
+
+    void send_frame(int opcode, std::string_view payload) {
+      // clients mask, the key doesn't matter to the server
+      std::string frame;
+      frame += static_cast<char>(0x80 | opcode);
+      if (payload.size() < 126) {
+        frame += static_cast<char>(0x80 | payload.size());
+      } else {
+        frame += static_cast<char>(0x80 | 126);
+        frame += static_cast<char>(payload.size() >> 8);
+        frame += static_cast<char>(payload.size());
+      }
+      const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+      frame.append(mask, 4);
+      for (size_t i = 0; i < payload.size(); ++i)
+        frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+      // small enough for the socket buffer of an idle connection
+      send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+    }
+
+    bool inflate_message() {
+      // RFC 7692: the sender dropped the final empty block's 00 00 ff ff
+      message.append("\x00\x00\xff\xff", 4);
+      inflated.clear();
+      inflater.next_in = reinterpret_cast<Bytef*>(message.data());
+      inflater.avail_in = static_cast<uInt>(message.size());
+      char out[65536];
+      do {
+        inflater.next_out = reinterpret_cast<Bytef*>(out);
+        inflater.avail_out = sizeof out;
+        auto res = inflate(&inflater, Z_SYNC_FLUSH);
+        if (res != Z_OK && res != Z_BUF_ERROR && res != Z_STREAM_END)
+          return false;
+        inflated.append(out, sizeof out - inflater.avail_out);
+      } while (inflater.avail_out == 0);
+      return true;
+    }
+  };
+
+  // the number after "key": in a JSON message, the last one unless first
+  uint64_t json_number(std::string_view message, std::string_view key,
+                       bool first = false) {
+    auto quoted = std::format("\"{}\":", key);
+    auto at = first ? message.find(quoted) : message.rfind(quoted);
+    if (at == std::string_view::npos) return 0;
+    return strtoull(message.data() + at + quoted.size(), nullptr, 10);
+  }
+
+  // the size of the file a STYLES_SHARED frame points at once read, 0 if it
+  // is gone or not as long as announced
+  size_t read_shared_style(std::string_view frame) {
+    auto payload = frame.substr(FRAME_HEADER_SIZE);
+    if (payload.size() < 4) return 0;
+    uint32_t length = 0;
+    for (int i = 3; i >= 0; --i)
+      length = (length << 8) | static_cast<uint8_t>(payload[i]);
+    std::ifstream ifs(std::string(payload.substr(4)), std::ios::binary);
+    std::string css((std::istreambuf_iterator<char>(ifs)), {});
+    return css.size() == length && length > 0 ? css.size() : 0;
+  }
+
+  // base of a delta frame, its payload may be deflated
+  uint64_t frame_delta_base(std::string_view frame, const FrameHeader& h) {
+    uint8_t base[8] = {};
+    auto payload = frame.substr(FRAME_HEADER_SIZE);
+    if (h.flags & FRAME_FLAG_DEFLATED) {
+      z_stream z{};
+      inflateInit2(&z, -MAX_WBITS);
+      z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+      z.avail_in = static_cast<uInt>(payload.size());
+      z.next_out = base;
+      z.avail_out = sizeof base;
+      inflate(&z, Z_SYNC_FLUSH);
+      inflateEnd(&z);
+    } else if (payload.size() >= sizeof base) {
+      memcpy(base, payload.data(), sizeof base);
+    }
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) value = (value << 8) | base[i];
+    return value;
+  }
+
+  double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    auto i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+  }
+
+  uWS::CompressOptions parse_compression(const std::string& name) {
+    if (name == "shared") return uWS::SHARED_COMPRESSOR;
+    if (name == "dedicated") return uWS::DEDICATED_COMPRESSOR;
+    return uWS::DISABLED;
+  }
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc >= 9 && strcmp(argv[1], SERVER_ARG) == 0)
+    return run_server(
+        atoi(argv[2]), static_cast<size_t>(atoll(argv[3])),
+        static_cast<size_t>(atoll(argv[4])),
+        {.compression = static_cast<uWS::CompressOptions>(atoi(argv[5])),
+         .maxBackpressure = static_cast<unsigned int>(atoll(argv[6])),
+         .sharedStyles = strcmp(argv[7], "1") == 0,
+         .workers = static_cast<unsigned int>(atoi(argv[8]))});
+
+  int clients = 200;
+  int executables = 4;
+  int updates = 50;
+  double rate = 10;
+  size_t size = 64 * 1024;
+  size_t edit = 0;
+  // what the service uses
+  std::string compression = "shared";
+  unsigned int maxBackpressure = 1 * 1024 * 1024;
+  bool useJson = false;
+  bool shared = false;
+  unsigned int serverWorkers = 1;
+  unsigned int threads = 4;
+
+  CLI::App app{"/client style fan-out load generator", "style_fanout_bench"};
+  app.add_option("-n,--clients", clients, "WebSocket clients");
+  app.add_option("-m,--executables", executables,
+                 "Applications the clients are spread over");
+  app.add_option("-u,--updates", updates, "Style updates per executable");
+  app.add_option("-r,--rate", rate,
+                 "Updates per second per executable, 0 for back to back");
+  app.add_option("-s,--size", size, "Stylesheet bytes");
+  app.add_option("-e,--edit", edit,
+                 "Bytes changed per update, 0 rewrites the whole stylesheet");
+  app.add_option("--compression", compression,
+                 "disabled, shared or dedicated (uWS compressor)");
+  app.add_option("--max-backpressure", maxBackpressure,
+                 "Bytes queued per socket before publishes skip it");
+  app.add_flag("--json", useJson, "Clients speak the JSON protocol");
+  app.add_flag("--shared", shared,
+               "Clients read large stylesheets from shared memory");
+  app.add_option("-t,--threads", threads, "Client receive threads");
+  app.add_option("-w,--server-workers", serverWorkers,
+                 "Server loops, each on its own thread");
+  CLI11_PARSE(app, argc, argv);
+  threads = std::max(threads, 1u);
+  executables = std::max(executables, 1);
+
+  signal(SIGPIPE, SIG_IGN);
+  auto server = spawn_server(
+      {"style_fanout_bench", SERVER_ARG, std::to_string(executables),
+       std::to_string(size), std::to_string(edit),
+       std::to_string(static_cast<int>(parse_compression(compression))),
+       std::to_string(maxBackpressure), shared ? "1" : "0",
+       std::to_string(serverWorkers)});
+
+  int port = 0;
+  char line[256];
+  while (port == 0 && fgets(line, sizeof line, server.out))
+    sscanf(line, "port %d", &port);
+  if (port == 0) {
+    fprintf(stderr, "The server didn't start\n");
+    return 1;
+  }
+
+  // when each version was asked for, [exe][version]. Version 1 is the
+  // stylesheet on disk, update k makes version k + 1.
+  auto versions = static_cast<size_t>(updates) + 2;
+  auto publishedAt =
+      std::make_unique<std::atomic<int64_t>[]>(executables * versions);
+
+  std::vector<std::unique_ptr<Client>> conns;
+  for (int i = 0; i < clients; ++i) {
+    auto client = std::make_unique<Client>(i % executables);
+    if (!client->connect(port)) {
+      fprintf(stderr, "Client %d failed to connect\n", i);
+      return 1;
+    }
+    client->send_text(
+        json({{"type", MessageType::HELLO},
+              {"exe", exe_name(client->exe)},
+              {"protocol", useJson  ? PROTOCOL_JSON
+                           : shared ? PROTOCOL_SHARED
+                                    : PROTOCOL_BINARY}})
+            .dump());
+    conns.push_back(std::move(client));
+  }
+
+  std::atomic<bool> stopping = false;
+  std::atomic<int> synced = 0;
+  std::atomic<uint64_t> resyncs = 0;
+  std::atomic<uint64_t> received = 0;
+  std::atomic<int64_t> lastProgress = now_ns();
+  std::atomic<int64_t> measureFrom = INT64_MAX;
+  std::vector<std::vector<double>> latencies(threads);
+
+  std::vector<std::thread> receivers;
+  for (unsigned int t = 0; t < threads; ++t) {
+    receivers.emplace_back([&, t] {
+      std::vector<Client*> mine;
+      std::vector<pollfd> fds;
+      for (size_t i = t; i < conns.size(); i += threads) {
+        mine.push_back(conns[i].get());
+        fds.push_back({.fd = conns[i]->socket_fd(), .events = POLLIN});
+      }
+
+      while (!stopping) {
+        if (poll(fds.data(), fds.size(), 20) <= 0) continue;
+        for (size_t i = 0; i < fds.size(); ++i) {
+          if (fds[i].revents == 0) continue;
+          auto client = mine[i];
+          auto open = client->receive([&](int opcode, std::string_view msg) {
+            auto now = now_ns();
+            if (now >= measureFrom) received += msg.size();
+
+            MessageType type;
+            uint64_t version, base = 0;
+            // only this thread writes it
+            auto have = client->version.load(std::memory_order_relaxed);
+            if (opcode == WS_OPCODE_BINARY) {
+              FrameHeader h;
+              if (!decode_frame_header(msg, h)) return;
+              type = h.type;
+              version = h.version;
+              if (type == MessageType::STYLES_DELTA)
+                base = frame_delta_base(msg, h);
+              if (type == MessageType::STYLES_SHARED) {
+                auto read = read_shared_style(msg);
+                // superseded already, the resync gets the current one
+                if (read == 0 && version > have) {
+                  resyncs++;
+                  client->send_text(json({{"type", MessageType::RESYNC},
+                                          {"exe", exe_name(client->exe)}})
+                                        .dump());
+                  return;
+                }
+                if (now >= measureFrom) received += read;
+                type = MessageType::STYLES_UPDATE;
+              }
+            } else {
+              type = static_cast<MessageType>(json_number(msg, "type"));
+              version = json_number(msg, "version");
+              base = json_number(msg, "base", true);
+            }
+            if (type != MessageType::STYLES_UPDATE &&
+                type != MessageType::STYLES_DELTA)
+              return;
+            // older than what the client has, a resync overtook it
+            if (version <= have) return;
+            if (type == MessageType::STYLES_DELTA && base != have) {
+              resyncs++;
+              client->send_text(json({{"type", MessageType::RESYNC},
+                                      {"exe", exe_name(client->exe)}})
+                                    .dump());
+              return;
+            }
+
+            if (have == 0) synced++;
+            client->version.store(version, std::memory_order_release);
+            lastProgress = now;
+            if (version >= versions) return;
+            auto published =
+                publishedAt[client->exe * versions + version].load();
+            if (published != 0)
+              latencies[t].push_back((now - published) / 1e6);
+          });
+          if (!open) {
+            fprintf(stderr, "A client was disconnected\n");
+            fds[i].fd = -1;
+          }
+        }
+      }
+    });
+  }
+
+  // everyone has the stylesheet from disk before the first update
+  auto deadline = steady::now() + std::chrono::seconds(30);
+  while (synced < clients && steady::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  if (synced < clients) {
+    fprintf(stderr, "Only %d of %d clients got their stylesheet\n",
+            synced.load(), clients);
+    return 1;
+  }
+
+  auto rssConnected = resident_bytes(server.pid);
+  std::atomic<size_t> rssPeak = rssConnected;
+  std::atomic<bool> publishing = true;
+  std::thread sampler([&] {
+    while (publishing) {
+      rssPeak = std::max(rssPeak.load(), resident_bytes(server.pid));
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+
+  auto cpuBefore = cpu_seconds(server.pid);
+  auto start = now_ns();
+  measureFrom = start;
+  for (int k = 1; k <= updates; ++k) {
+    for (int e = 0; e < executables; ++e) {
+      publishedAt[e * versions + k + 1] = now_ns();
+      fprintf(server.in, "%d\n", e);
+      fflush(server.in);
+    }
+    if (rate > 0) {
+      auto next = start + static_cast<int64_t>(k * 1e9 / rate);
+      std::this_thread::sleep_for(std::chrono::nanoseconds(next - now_ns()));
+    }
+  }
+  auto published = now_ns();
+
+  // until every client has the last version or nothing moves anymore
+  auto settle =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(SETTLE_TIMEOUT)
+          .count();
+  while (now_ns() - std::max(lastProgress.load(), published) < settle) {
+    bool done = true;
+    for (auto& c : conns)
+      done &= c->version.load(std::memory_order_acquire) >= versions - 1;
+    if (done) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  auto end = std::max(lastProgress.load(), published);
+  publishing = false;
+  sampler.join();
+  rssPeak = std::max(rssPeak.load(), resident_bytes(server.pid));
+  auto serverCpu = cpu_seconds(server.pid) - cpuBefore;
+
+  stopping = true;
+  for (auto& receiver : receivers) receiver.join();
+  fprintf(server.in, "quit\n");
+  fflush(server.in);
+  waitpid(server.pid, nullptr, 0);
+
+  std::vector<double> all;
+  for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  auto expected = static_cast<uint64_t>(clients) * updates;
+  auto seconds = (end - start) / 1e9;
+
+  printf("%d clients on %d executables, %u server loops, %s protocol, %s "
+         "compression, %u B max backpressure\n",
+         clients, executables, serverWorkers,
+         useJson  ? "JSON"
+         : shared ? "shared"
+                  : "binary",
+         compression.c_str(), maxBackpressure);
+  printf("%d updates per executable at %s, %zu B stylesheets, %s\n", updates,
+         rate > 0 ? std::format("{}/s", rate).c_str() : "full speed", size,
+         edit == 0 ? "rewritten whole"
+                   : std::format("{} B edits", edit).c_str());
+  printf("  delivered   %8zu of %llu versions (%llu skipped, %llu resyncs)\n",
+         all.size(), static_cast<unsigned long long>(expected),
+         static_cast<unsigned long long>(expected - all.size()),
+         static_cast<unsigned long long>(resyncs.load()));
+  printf("  latency     %8.2f ms p50 %8.2f ms p99 %8.2f ms max\n",
+         percentile(all, 0.5), percentile(all, 0.99),
+         all.empty() ? 0.0 : all.back());
+  printf("  throughput  %8.0f messages/s %8.1f MB/s received\n",
+         all.size() / seconds, received / seconds / (1024 * 1024));
+  printf("  server RSS  %8.1f MB connected %8.1f MB peak\n",
+         rssConnected / (1024.0 * 1024), rssPeak / (1024.0 * 1024));
+  printf("  server CPU  %8.2f ms per update\n",
+         serverCpu * 1000 / (static_cast<double>(updates) * executables));
+}
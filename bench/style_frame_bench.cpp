@@ -0,0 +1,83 @@
+// Compares the JSON style messages with the binary frames of PROTOCOL_BINARY:
+// encode and decode time and bytes on the wire, for full stylesheets of
+// 10 KB, 1 MB and 10 MB. Decoding is what the client does, here with
+// nlohmann::json standing in for JSON.parse.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+#include <string>
+
+#include "../src/service/protocol.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+  // a theme with the usual share of quotes, escapes and non-ASCII
+  std::string make_css(size_t size) {
+    std::string css;
+    for (int i = 0; css.size() < size; ++i) {
+      css += ".c" + std::to_string(i) +
+             "::before { content: \"\\f10" + std::to_string(i % 10) +
+             "\"; font-family: 'Icons'; color: #1e1e2e; }\n"
+             "[data-tab=\"ünïcödé\"] > .c" +
+             std::to_string(i) + " { background: url(\"a/b.png\"); }\n";
+    }
+    css.resize(size);
+    return css;
+  }
+
+  template <typename Fn>
+  double ns_per_call(int iterations, Fn fn) {
+    fn();  // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) fn();
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           iterations;
+  }
+
+  void print(const char* name, size_t bytes, double encodeNs,
+             double decodeNs) {
+    printf("  %-6s %10zu B %12.0f ns encode %12.0f ns decode\n", name, bytes,
+           encodeNs, decodeNs);
+  }
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+  for (size_t size : {10 * 1024, 1024 * 1024, 10 * 1024 * 1024}) {
+    auto css = make_css(size);
+    printf("stylesheet of %zu bytes (%d iterations)\n", css.size(),
+           iterations);
+
+    std::string message;
+    auto jsonEncode = ns_per_call(iterations, [&] {
+      message = json({{"type", MessageType::STYLES_UPDATE},
+                      {"version", 7},
+                      {"css", css}})
+                    .dump();
+    });
+    auto jsonDecode = ns_per_call(iterations, [&] {
+      auto p = json::parse(message);
+      if (p["css"].get_ref<const std::string&>().size() != css.size())
+        abort();
+    });
+    print("json", message.size(), jsonEncode, jsonDecode);
+
+    std::string frame;
+    auto frameEncode = ns_per_call(
+        iterations, [&] { frame = encode_styles_frame(0, 7, css); });
+    auto frameDecode = ns_per_call(iterations, [&] {
+      FrameHeader header;
+      if (!decode_frame_header(frame, header)) abort();
+      // the client's Buffer.toString('utf8')
+      std::string decoded(frame.data() + FRAME_HEADER_SIZE, header.length);
+      if (decoded.size() != css.size()) abort();
+    });
+    print("binary", frame.size(), frameEncode, frameDecode);
+  }
+}
@@ -1,4 +1,19 @@
 export const MESSAGE_TYPES = {
   Hello: 0,
   StylesUpdate: 1,
+  StylesDelta: 2,
+  Connected: 3,
+  Resync: 4,
+  // once per process, the first stylesheet made it onto a page
+  StylesApplied: 5,
+  // the stylesheet is in a file, see readSharedStyle
+  StylesShared: 6,
+}
+
+export const PROTOCOL = {
+  Json: 1,
+  // style messages arrive as binary frames, see frames.js
+  Binary: 2,
+  // Binary, but large stylesheets are read from shared memory
+  Shared: 3,
 }
@@ -0,0 +1,66 @@
+import { readFileSync } from 'fs'
+import { inflateRawSync } from 'zlib'
+import { MESSAGE_TYPES } from './constants'
+
+// Mirrors src/service/protocol.hpp. All fields are little-endian:
+//   u8 type, u8 flags, u16 appId, u32 length, u64 version, then the payload
+const HEADER_SIZE = 16
+const DELTA_HEADER_SIZE = 16
+// the payload is raw deflate
+const FLAG_DEFLATED = 0x01
+
+// Turns a binary frame into the same message object the JSON protocol has,
+// or returns null if it's malformed
+export function decodeFrame(buf) {
+  if (buf.length < HEADER_SIZE) return null
+  const type = buf.readUInt8(0)
+  const flags = buf.readUInt8(1)
+  const length = buf.readUInt32LE(4)
+  const version = Number(buf.readBigUInt64LE(8))
+  if (buf.length - HEADER_SIZE < length) return null
+  let payload = buf.subarray(HEADER_SIZE, HEADER_SIZE + length)
+  if (flags & FLAG_DEFLATED) {
+    try {
+      payload = inflateRawSync(payload)
+    } catch {
+      return null
+    }
+  }
+
+  switch (type) {
+    case MESSAGE_TYPES.StylesUpdate:
+      return { type, version, css: payload.toString('utf8') }
+    case MESSAGE_TYPES.StylesDelta:
+      if (payload.length < DELTA_HEADER_SIZE) return null
+      return {
+        type,
+        version,
+        base: Number(payload.readBigUInt64LE(0)),
+        start: payload.readUInt32LE(8),
+        deleteCount: payload.readUInt32LE(12),
+        insert: payload.toString('utf8', DELTA_HEADER_SIZE),
+      }
+    case MESSAGE_TYPES.StylesShared:
+      if (payload.length < 4) return null
+      return {
+        type,
+        version,
+        length: payload.readUInt32LE(0),
+        path: payload.toString('utf8', 4),
+      }
+    default:
+      return { type, version }
+  }
+}
+
+// The stylesheet a StylesShared message points at, or null if the server
+// already dropped that version
+export function readSharedStyle(msg) {
+  try {
+    const buf = readFileSync(msg.path)
+    if (buf.length !== msg.length) return null
+    return buf.toString('utf8')
+  } catch {
+    return null
+  }
+}
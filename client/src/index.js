@@ -1,24 +1,36 @@
-import { MESSAGE_TYPES } from './constants'
+import { MESSAGE_TYPES, PROTOCOL } from './constants'
 import { EventEmitter } from 'events'
 import { app, session, webContents } from 'electron'
 import WebSocket from 'ws'
 import console from './console'
-import { setStyleSheet, setupWebContents } from './styles'
+import { decodeFrame, readSharedStyle } from './frames'
+import {
+  applyStyleDelta,
+  onFirstStyleApplied,
+  setStyleSheet,
+  setupWebContents,
+} from './styles'
 
 const executableName = (globalThis || global).electrothemeOptions.executableName
 const removeCSP = (globalThis || global).electrothemeOptions.removeCSP
 const port = (globalThis || global).electrothemeOptions.port
+const socketPath = (globalThis || global).electrothemeOptions.socketPath
+const pid = (globalThis || global).electrothemeOptions.pid
 
 const RETRY_TIME = 50
 
 class EWS extends EventEmitter {
   url
+  // used instead of url once url failed before ever opening
+  fallbackUrl
+  opened = false
   retries = 0
   selfClose = false
   reconnecting = false
-  constructor(url) {
+  constructor(url, fallbackUrl) {
     super()
     this.url = url
+    this.fallbackUrl = fallbackUrl
   }
   send(type, params) {
     return this.ws.send(
@@ -46,17 +58,31 @@ class EWS extends EventEmitter {
     this.ws.on('close', this.onClose)
   }
   onError = (err) => {
+    if (!this.opened && this.fallbackUrl) {
+      console.warn('Connecting to', this.url, 'failed, using', this.fallbackUrl)
+      this.url = this.fallbackUrl
+      this.fallbackUrl = null
+      return
+    }
     if (this.reconnecting) {
       this.retries++
     }
     console.error('Error in WebSocket', err)
   }
   onOpen = () => {
+    this.opened = true
     this.retries = 0
     this.reconnecting = false
     this.emit('open')
   }
-  onMessage = (message) => {
+  onMessage = (message, isBinary) => {
+    // style messages are binary frames, everything else is JSON text
+    if (isBinary) {
+      const payload = decodeFrame(message)
+      if (payload) this.emit('message', payload)
+      else console.error('Failed to decode frame of', message.length, 'bytes')
+      return
+    }
     let str = message.toString('utf8')
     try {
       let payload = JSON.parse(str)
@@ -73,17 +99,57 @@ class EWS extends EventEmitter {
   }
 }
 
-const ws = new EWS('ws://127.0.0.1:' + port.toString() + '/client')
+const tcpUrl = 'ws://127.0.0.1:' + port.toString() + '/client'
+// Linux only, the service listens on a Unix domain socket as well
+const ws = socketPath
+  ? new EWS('ws+unix:' + socketPath + ':/client', tcpUrl)
+  : new EWS(tcpUrl)
+// Binary once shared memory turned out to be unreadable from here
+let protocol = PROTOCOL.Shared
+// a version read from shared memory failed for, the resync may fail as well
+let sharedFailedVersion = null
 ws.on('open', () => {
   ws.send(MESSAGE_TYPES.Hello, {
     exe: executableName,
+    pid,
+    protocol,
   })
 })
+// for the server's time-to-theme metrics
+onFirstStyleApplied((version) => {
+  ws.send(MESSAGE_TYPES.StylesApplied, { exe: executableName, pid, version })
+})
 ws.on('message', (msg) => {
   switch (msg.type) {
     case MESSAGE_TYPES.StylesUpdate:
-      setStyleSheet(msg.css)
+      setStyleSheet(msg.css, msg.version)
+      break
+    case MESSAGE_TYPES.StylesDelta:
+      if (!applyStyleDelta(msg))
+        ws.send(MESSAGE_TYPES.Resync, {
+          exe: executableName,
+        })
       break
+    case MESSAGE_TYPES.StylesShared: {
+      // read synchronously, a delta on top of it may be next
+      const css = readSharedStyle(msg)
+      if (css !== null) {
+        setStyleSheet(css, msg.version)
+        break
+      }
+      if (sharedFailedVersion === msg.version) {
+        // not just superseded, reconnect without shared memory
+        console.warn('Reading', msg.path, 'failed, not using shared memory')
+        protocol = PROTOCOL.Binary
+        ws.ws.close()
+        break
+      }
+      sharedFailedVersion = msg.version
+      ws.send(MESSAGE_TYPES.Resync, {
+        exe: executableName,
+      })
+      break
+    }
     default:
       break
   }
@@ -114,6 +180,5 @@ if (removeCSP) {
 }
 
 webContents.getAllWebContents().forEach((wc) => setupWebContents(wc))
-// Kills the inspector thread in the process, freeing :9229 for the next process
-// and closing the WebSocket connection to :9229
-process._debugEnd()
+// The loader ends the debugging session (process._debugEnd()) once it is done
+// with the inspector
@@ -1,30 +1,92 @@
 import { webContents } from 'electron'
 
 let currentStyleSheet = ''
+// the server's version of currentStyleSheet, null until the first update
+let currentVersion = null
+// called once the first stylesheet is on a page
+let onFirstApplied = null
 
-const fnRenderer = () => {
+// Both run in the renderer, they can't refer to anything outside themselves
+const fnRenderer = (css, version) => {
   let style = document.querySelector('style#electrotheme')
   if (!style) {
     style = document.createElement('style')
     style.setAttribute('id', 'electrotheme')
     document.head.appendChild(style)
   }
-  style.innerHTML = atob(`{css}`)
+  style.textContent = css
+  style.dataset.version = version
+}
+const fnRendererDelta = (base, version, start, deleteCount, insert) => {
+  const style = document.querySelector('style#electrotheme')
+  if (!style || style.dataset.version !== String(base)) return false
+  const css = style.textContent
+  style.textContent =
+    css.slice(0, start) + insert + css.slice(start + deleteCount)
+  style.dataset.version = version
+  return true
+}
+
+function runInRenderer(wc, fn, ...args) {
+  const code = fn.toString() // "() => {/*...*/}"
+  const params = args.map((a) => JSON.stringify(a)).join(',')
+  return wc.executeJavaScript(';(' + code + ')(' + params + ');', true)
 }
 function injectStyle(wc, style) {
   if (!wc) return
-  let code = fnRenderer.toString() // "() => {/*...*/}"
-  code = code.replace(
-    /\{css}/gi,
-    Buffer.from(style, 'utf8').toString('base64') // lol
+  const version = currentVersion
+  runInRenderer(wc, fnRenderer, style, version)
+    .then(() => {
+      if (version === null || !onFirstApplied) return
+      const cb = onFirstApplied
+      onFirstApplied = null
+      cb(version)
+    })
+    .catch(() => {})
+}
+function injectDelta(wc, delta) {
+  if (!wc) return
+  runInRenderer(
+    wc,
+    fnRendererDelta,
+    delta.base,
+    delta.version,
+    delta.start,
+    delta.deleteCount,
+    delta.insert
   )
-  wc.executeJavaScript(';(' + code + ')();', true)
+    .then((applied) => {
+      // the page was reloaded or missed an update
+      if (!applied) injectStyle(wc, currentStyleSheet)
+    })
+    .catch(() => {})
 }
 
-export function setStyleSheet(style) {
+export function setStyleSheet(style, version) {
   currentStyleSheet = style
+  currentVersion = version
   updateAllWebContents()
 }
+// Returns false if the delta wasn't made against the stylesheet we have, the
+// caller should ask the server for a resync then
+export function applyStyleDelta(delta) {
+  // a full update is on its way, or this one is older than what we have
+  if (currentVersion === null || delta.version <= currentVersion) return true
+  if (delta.base !== currentVersion) return false
+
+  currentStyleSheet =
+    currentStyleSheet.slice(0, delta.start) +
+    delta.insert +
+    currentStyleSheet.slice(delta.start + delta.deleteCount)
+  currentVersion = delta.version
+
+  const wcs = webContents.getAllWebContents()
+  if (Array.isArray(wcs)) wcs.forEach((wc) => injectDelta(wc, delta))
+  return true
+}
+export function onFirstStyleApplied(cb) {
+  onFirstApplied = cb
+}
 export function getStyleSheet() {
   return currentStyleSheet
 }
@@ -0,0 +1,61 @@
+#include "attachpolicy.hpp"
+
+#include <algorithm>
+
+using namespace std::chrono_literals;
+
+namespace {
+  constexpr std::string_view stageNames[] = {
+      "processSeen",  "debugHandlerPresent", "inspectorListening",
+      "targetListed", "wsConnected",         "scriptEvaluated"};
+
+  void read_ms(const nlohmann::json& j, const char* key,
+               std::chrono::milliseconds& out) {
+    if (j.contains(key) && j[key].is_number_unsigned())
+      out = std::chrono::milliseconds(j[key].get<uint64_t>());
+  }
+  void read_double(const nlohmann::json& j, const char* key, double& out) {
+    if (j.contains(key) && j[key].is_number()) out = j[key].get<double>();
+  }
+}  // namespace
+
+std::string_view attach_stage_name(AttachStage stage) {
+  auto i = static_cast<size_t>(stage);
+  return i < std::size(stageNames) ? stageNames[i] : "?";
+}
+
+attach_policy_t::attach_policy_t() {
+  using enum AttachStage;
+  // not probed, the process source already saw the process
+  (*this)[ProcessSeen] = {0ms, 0ms, 1.0, 0.0, 0ms};
+  // node sets up its debug handler early during startup
+  (*this)[DebugHandlerPresent] = {5ms, 100ms, 2.0, 0.2, 10000ms};
+  (*this)[InspectorListening] = {2ms, 50ms, 2.0, 0.2, 5000ms};
+  (*this)[TargetListed] = {5ms, 100ms, 2.0, 0.2, 5000ms};
+  (*this)[WsConnected] = {5ms, 100ms, 2.0, 0.2, 2000ms};
+  // only the deadline applies, replies are awaited rather than probed
+  (*this)[ScriptEvaluated] = {0ms, 0ms, 1.0, 0.0, 30000ms};
+}
+
+AttachPolicy parse_attach_policy(const nlohmann::json& j) {
+  AttachPolicy policy;
+  if (!j.is_object()) return policy;
+
+  for (size_t i = 0; i < policy.stages.size(); ++i) {
+    auto name = std::string(stageNames[i]);
+    if (!j.contains(name) || !j[name].is_object()) continue;
+
+    auto& stage = j[name];
+    auto& p = policy.stages[i];
+    read_ms(stage, "initialDelay", p.initialDelay);
+    read_ms(stage, "maxDelay", p.maxDelay);
+    read_ms(stage, "deadline", p.deadline);
+    read_double(stage, "multiplier", p.multiplier);
+    read_double(stage, "jitter", p.jitter);
+
+    p.multiplier = std::max(p.multiplier, 1.0);
+    p.jitter = std::clamp(p.jitter, 0.0, 1.0);
+    p.maxDelay = std::max(p.maxDelay, p.initialDelay);
+  }
+  return policy;
+}
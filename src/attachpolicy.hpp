@@ -0,0 +1,66 @@
+#ifndef ATTACHPOLICY_HPP
+#define ATTACHPOLICY_HPP
+
+#include <array>
+#include <chrono>
+#include <format>
+#include <nlohmann/json.hpp>
+#include <string_view>
+
+// Stages of attaching to a process, in order. ProcessSeen is reached when a
+// loader worker takes the process up, timed from the process event. Each
+// later stage is entered once its readiness probe succeeds.
+enum class AttachStage {
+  ProcessSeen = 0,
+  DebugHandlerPresent,
+  InspectorListening,
+  TargetListed,
+  WsConnected,
+  ScriptEvaluated,
+  Count
+};
+
+std::string_view attach_stage_name(AttachStage stage);
+
+template <>
+struct std::formatter<AttachStage> : std::formatter<std::string_view> {
+  template <class FormatContext>
+  auto format(AttachStage s, FormatContext& ctx) const {
+    return formatter<string_view>::format(attach_stage_name(s), ctx);
+  }
+};
+
+// How a stage's probe is retried. The delay between attempts starts at
+// initialDelay and grows by multiplier. It is randomized by +-jitter (a
+// fraction of the delay) and then capped at maxDelay. The stage fails once
+// deadline has passed since the previous stage was reached.
+typedef struct backoff_policy_t {
+  std::chrono::milliseconds initialDelay;
+  std::chrono::milliseconds maxDelay;
+  double multiplier = 2.0;
+  double jitter = 0.2;
+  std::chrono::milliseconds deadline;
+
+  bool operator==(const backoff_policy_t&) const = default;
+} BackoffPolicy;
+
+// Per application, configured through the "attach" object in config.json:
+//   "attach": { "targetListed": { "initialDelay": 5, "deadline": 5000 } }
+// Durations are in milliseconds, omitted fields keep their defaults.
+typedef struct attach_policy_t {
+  std::array<BackoffPolicy, static_cast<size_t>(AttachStage::Count)> stages;
+
+  attach_policy_t();
+
+  const BackoffPolicy& operator[](AttachStage stage) const {
+    return stages[static_cast<size_t>(stage)];
+  }
+  BackoffPolicy& operator[](AttachStage stage) {
+    return stages[static_cast<size_t>(stage)];
+  }
+  bool operator==(const attach_policy_t&) const = default;
+} AttachPolicy;
+
+AttachPolicy parse_attach_policy(const nlohmann::json& j);
+
+#endif /* ATTACHPOLICY_HPP */
@@ -1,5 +1,3 @@
-#include <Windows.h>
-
 #include "../config.hpp"
 #include "cli.hpp"
 
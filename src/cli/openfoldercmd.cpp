@@ -1,5 +1,10 @@
-#include <Windows.h>
-#include <shellapi.h>
+#ifdef _WIN32
+  #include <Windows.h>
+  #include <shellapi.h>
+#else
+  #include <spawn.h>
+  #include <unistd.h>
+#endif
 
 #include "../config.hpp"
 #include "../log.hpp"
@@ -13,7 +18,14 @@ void load_command_openfolder(CLI::App& app) {
     auto chFolderPath = stlFolderPath.c_str();
     __print(stdout, "Opening folder \"{}\" in File Explorer", chFolderPath);
 
+#ifdef _WIN32
     ShellExecuteA(nullptr, "open", chFolderPath, nullptr, nullptr,
                   SW_SHOWDEFAULT);
+#else
+    pid_t pid;
+    const char* argv[] = {"xdg-open", chFolderPath, nullptr};
+    posix_spawnp(&pid, "xdg-open", nullptr, nullptr,
+                 const_cast<char* const*>(argv), environ);
+#endif
   });
 }
@@ -1,12 +1,20 @@
+#define LOG_CATEGORY LogCategory::Config
+
 #include "config.hpp"
 
-#include <ShlObj.h>
+#ifdef _WIN32
+  #include <ShlObj.h>
+#endif
 
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 
 #include "log.hpp"
+#include "service/cssminify.hpp"
+#include "stylebundler.hpp"
 
 std::unique_ptr<Config> gConfig;
 
@@ -15,23 +23,41 @@ struct std::formatter<std::filesystem::path>
     : std::formatter<std::string_view> {
   template <class FormatContext>
   auto format(std::filesystem::path a, FormatContext& ctx) const {
+#ifdef _WIN32
     std::wstring h = a.c_str();
     return formatter<string_view>::format(std::string(h.begin(), h.end()), ctx);
+#else
+    return formatter<string_view>::format(a.string(), ctx);
+#endif
   }
 };
 
 void Config::set_config_directory(std::string& configDirectory) {
   if (configDirectory.empty()) {
+#ifdef _WIN32
     wchar_t* wcPath;
     auto status = SHGetKnownFolderPath(FOLDERID_RoamingAppData, KF_FLAG_CREATE,
                                        nullptr, &wcPath);
     config_directory = wcPath;
+#else
+    // $XDG_CONFIG_HOME, falling back to ~/.config
+    if (auto xdg = getenv("XDG_CONFIG_HOME"); xdg != nullptr && *xdg != 0) {
+      config_directory = xdg;
+    } else {
+      auto home = getenv("HOME");
+      config_directory = home != nullptr ? home : ".";
+      config_directory /= ".config";
+    }
+    std::filesystem::create_directories(config_directory);
+#endif
     config_directory /= CONFIG_DIRECTORY;
   } else {
     config_directory = configDirectory;
   }
   styles_directory = config_directory / STYLES_DIRECTORY;
   scripts_directory = config_directory / SCRIPTS_DIRECTORY;
+  // created once the first code cache is stored
+  cache_directory = config_directory / CACHE_DIRECTORY;
   config_file = config_directory / CONFIG_FILE;
 
   if (!std::filesystem::exists(config_directory)) {
@@ -57,7 +83,7 @@ void Config::set_config_directory(std::string& configDirectory) {
   DbgLog("Config directory: {}", config_directory);
 }
 
-void Config::load_file(bool silent) {
+ConfigDiff Config::load_file(bool silent) {
   DbgLog("Loading config from file {}", config_file);
   try {
     std::ifstream ifs(config_file);
@@ -66,13 +92,34 @@ void Config::load_file(bool silent) {
     config = json::parse(buf);
     ifs.close();
 
-    if (config == nullptr) return;
-    load_applications();
+    if (config == nullptr) return {};
+
+    if (config.contains("loaderWorkers") &&
+        config["loaderWorkers"].is_number_unsigned())
+      loaderWorkers = std::max(config["loaderWorkers"].get<unsigned int>(), 1u);
+
+    if (config.contains("serverWorkers") &&
+        config["serverWorkers"].is_number_unsigned())
+      serverWorkers = std::max(config["serverWorkers"].get<unsigned int>(), 1u);
+
+    if (config.contains("watchQuietWindow") &&
+        config["watchQuietWindow"].is_number_unsigned())
+      watchQuietWindow = std::chrono::milliseconds(
+          config["watchQuietWindow"].get<unsigned int>());
+
+    if (config.contains("unixSocket") && config["unixSocket"].is_boolean())
+      unixSocket = config["unixSocket"].get<bool>();
+    if (config.contains("sharedStyles") && config["sharedStyles"].is_boolean())
+      sharedStyles = config["sharedStyles"].get<bool>();
+
+    load_log_levels();
+    return load_applications();
   } catch (const std::exception& ex) {
     __print(stderr, "Failed to read config from disk\n{}\ncfg = {}\n\nExiting.",
-            ex.what());
+            ex.what(), config.dump());
     if (!silent) exit(1);
   }
+  return {};
 }
 
 void Config::save_file() {
@@ -82,15 +129,15 @@ void Config::save_file() {
   ofs.close();
 }
 
-void Config::load_applications() {
+ConfigDiff Config::load_applications() {
   try {
-    auto jsonApplications = config["applications"];
-    if (!config.contains("applications") || !jsonApplications.is_array())
-      return;
-
-    watchedExecutables.clear();
-    applications.clear();
+    // missing or not a list, there are no applications: the ones loaded
+    // before are removed like any other
+    auto jsonApplications = json::array();
+    if (config.contains("applications") && config["applications"].is_array())
+      jsonApplications = config["applications"];
 
+    std::vector<Application> applications;
     for (const auto& e : jsonApplications) {
       auto jsonName = e["name"];
       auto jsonDirectory = e["directory"];
@@ -101,19 +148,6 @@ void Config::load_applications() {
       app.name = e["name"].get<std::string>();
       app.directory = e["directory"].get<std::string>();
 
-      if (app.directory != "") {
-        auto appStyleDir = styles_directory / app.directory;
-        auto appScriptDir = scripts_directory / app.directory;
-        if (!std::filesystem::exists(appStyleDir)) {
-          DbgLog("Creating application style directory {}", appStyleDir);
-          std::filesystem::create_directory(appStyleDir);
-        }
-        if (!std::filesystem::exists(appScriptDir)) {
-          DbgLog("Creating application script directory {}", appScriptDir);
-          std::filesystem::create_directory(appScriptDir);
-        }
-      }
-
       // css path
       if (e.contains("style") && e["style"].is_string()) {
         app.style = e["style"].get<std::string>();
@@ -129,67 +163,177 @@ void Config::load_applications() {
 
       if (e.contains("removeCSP") && e["removeCSP"].is_boolean()) {
         app.removeCSP = e["removeCSP"].get<bool>();
-        if (app.removeCSP) {
-          __print(stderr,
-                  "!! {} will have its Content-Security-Policy removed to "
-                  "allow for unsafe CSS @imports !!",
-                  app.name);
-        }
       } else {
         app.removeCSP = false;
       }
 
-      DbgLog("Adding {} to Config applications", app);
+      if (e.contains("attach")) app.attach = parse_attach_policy(e["attach"]);
+
+      if (e.contains("injectionMode") && e["injectionMode"].is_string()) {
+        auto mode = e["injectionMode"].get<std::string>();
+        if (mode == "codeCache") {
+          app.injectionMode = InjectionMode::CodeCache;
+        } else if (mode != "evaluate") {
+          __print(stderr, "Unknown injectionMode \"{}\" for {}, using evaluate",
+                  mode, app.name);
+        }
+      }
+
+      if (e.contains("minify") && e["minify"].is_boolean())
+        app.minify = e["minify"].get<bool>();
 
-      watchedExecutables.insert(app.name);
       applications.push_back(app);
     }
+
+    auto previous = snapshot();
+    auto next = std::make_shared<const ConfigSnapshot>(std::move(applications));
+    auto diff = previous->diff(*next);
+    // nothing to publish, readers keep the snapshot and caches built from it
+    if (diff.empty()) return diff;
+
+    // only what the edit touched is created or warned about again
+    std::vector<const Application*> touched;
+    for (const auto& app : diff.added) {
+      DbgLog("Adding {} to Config applications", app);
+      touched.push_back(&app);
+    }
+    for (const auto& change : diff.changed) {
+      DbgLog("Updating {} in Config applications", change.after);
+      touched.push_back(&change.after);
+    }
+    for (const auto& app : diff.removed)
+      DbgLog("Removing {} from Config applications", app);
+
+    for (auto app : touched) {
+      create_application_directories(*app);
+      if (app->removeCSP) {
+        __print(stderr,
+                "!! {} will have its Content-Security-Policy removed to "
+                "allow for unsafe CSS @imports !!",
+                app->name);
+      }
+    }
+
+    current.store(std::move(next));
+    return diff;
   } catch (const std::exception& ex) {
     __print(stderr, "Failed to load applications from config: {}", ex.what());
   }
+  return {};
 }
 
-Application& Config::get_application_by_directory(
+void Config::load_log_levels() {
+  auto& logger = Logger::instance();
+  LogLevel level = DEFAULT_LOG_LEVEL;
+  if (config.contains("logLevel") && config["logLevel"].is_string()) {
+    auto name = config["logLevel"].get<std::string>();
+    if (!parse_log_level(name, level))
+      __print(stderr, "Unknown logLevel \"{}\"", name);
+  }
+  logger.set_level(level);
+
+  if (!config.contains("logLevels") || !config["logLevels"].is_object())
+    return;
+  for (const auto& [name, value] : config["logLevels"].items()) {
+    LogCategory category;
+    if (!parse_log_category(name, category) || !value.is_string() ||
+        !parse_log_level(value.get<std::string>(), level)) {
+      __print(stderr, "Ignoring logLevels entry \"{}\"", name);
+      continue;
+    }
+    logger.set_level(category, level);
+  }
+}
+
+void Config::create_application_directories(const Application& app) {
+  if (app.directory == "") return;
+  auto appStyleDir = styles_directory / app.directory;
+  auto appScriptDir = scripts_directory / app.directory;
+  if (!std::filesystem::exists(appStyleDir)) {
+    DbgLog("Creating application style directory {}", appStyleDir);
+    std::filesystem::create_directory(appStyleDir);
+  }
+  if (!std::filesystem::exists(appScriptDir)) {
+    DbgLog("Creating application script directory {}", appScriptDir);
+    std::filesystem::create_directory(appScriptDir);
+  }
+}
+
+ConfigSnapshot::ConfigSnapshot(std::vector<Application> applications)
+    : applications(std::move(applications)) {
+  byExecutable.reserve(this->applications.size());
+  byDirectory.reserve(this->applications.size());
+  for (const auto& app : this->applications) {
+    byExecutable.emplace(app.name, &app);
+    byDirectory.emplace(app.directory, &app);
+  }
+}
+
+const Application* ConfigSnapshot::by_executable(
+    const std::string& executable) const {
+  auto it = byExecutable.find(executable);
+  return it == byExecutable.end() ? nullptr : it->second;
+}
+
+const Application* ConfigSnapshot::by_directory(
+    const std::string& directory) const {
+  auto it = byDirectory.find(directory);
+  return it == byDirectory.end() ? nullptr : it->second;
+}
+
+ConfigDiff ConfigSnapshot::diff(const ConfigSnapshot& next) const {
+  ConfigDiff diff;
+  for (const auto& app : next.applications) {
+    // duplicates are shadowed by the first application of that name
+    if (next.by_executable(app.name) != &app) continue;
+    auto before = by_executable(app.name);
+    if (before == nullptr) {
+      diff.added.push_back(app);
+      continue;
+    }
+
+    unsigned fields = 0;
+    if (before->directory != app.directory) fields |= APP_DIRECTORY;
+    if (before->style != app.style) fields |= APP_STYLE;
+    if (before->script != app.script) fields |= APP_SCRIPT;
+    if (before->removeCSP != app.removeCSP) fields |= APP_REMOVE_CSP;
+    if (before->attach != app.attach) fields |= APP_ATTACH;
+    if (before->injectionMode != app.injectionMode)
+      fields |= APP_INJECTION_MODE;
+    if (before->minify != app.minify) fields |= APP_MINIFY;
+    if (fields != 0)
+      diff.changed.push_back(
+          {.before = *before, .after = app, .fields = fields});
+  }
+  for (const auto& app : applications) {
+    if (by_executable(app.name) == &app && !next.watches(app.name))
+      diff.removed.push_back(app);
+  }
+  return diff;
+}
+
+Application Config::get_application_by_directory(
     const std::string& directory) {
-  auto it = std::find_if(applications.begin(), applications.end(),
-                         [directory](const Application& a) {
-                           return a.directory.compare(directory) == 0;
-                         });
-  if (it == applications.end())
+  auto app = snapshot()->by_directory(directory);
+  if (app == nullptr)
     throw std::runtime_error("Application with directory \"" + directory +
                              "\" does not exist");
-  return *it;
+  return *app;
 }
-Application& Config::get_application_by_executable(
+Application Config::get_application_by_executable(
     const std::string& executable) {
-  auto it = std::find_if(applications.begin(), applications.end(),
-                         [executable](const Application& a) {
-                           return a.name.compare(executable) == 0;
-                         });
-  if (it == applications.end())
+  auto app = snapshot()->by_executable(executable);
+  if (app == nullptr)
     throw std::runtime_error("Application with executable name \"" +
                              executable + "\" does not exist");
-  return *it;
+  return *app;
 }
 
-std::string application_t::get_style() {
-  std::filesystem::path p = gConfig->styles_directory / directory / style;
-  std::ifstream ifs(p);
-  std::stringstream buf;
-
-  buf << ifs.rdbuf();
-  auto str = buf.str();
-
-  return str;
+std::string application_t::get_style() const {
+  auto css = gBundler->bundle(*this);
+  return minify ? minify_css(css) : css;
 }
 
-std::string application_t::get_script() {
-  std::filesystem::path p = gConfig->scripts_directory / directory / script;
-  std::ifstream ifs(p);
-  std::stringstream buf;
-
-  buf << ifs.rdbuf();
-  auto str = buf.str();
-
-  return str;
+FileContents application_t::get_script() const {
+  return gFileCache->get(gConfig->scripts_directory / directory / script);
 }
@@ -1,30 +1,86 @@
 #ifndef CONFIG_HPP
 #define CONFIG_HPP
 
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <memory>
 #include <nlohmann/json.hpp>
-#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "attachpolicy.hpp"
+#include "filecache.hpp"
+
 #define CONFIG_DIRECTORY "electrotheme"
 #define STYLES_DIRECTORY "styles"
 #define SCRIPTS_DIRECTORY "scripts"
+#define CACHE_DIRECTORY "cache"
 #define CONFIG_FILE "config.json"
+// in the config directory, only the user can enter it. See
+// Config::unixSocket.
+#define SOCKET_DIRECTORY "run"
+#define SOCKET_FILE "client.sock"
+#define DEFAULT_LOADER_WORKERS 4
+#define DEFAULT_SERVER_WORKERS 1
+#define DEFAULT_WATCH_QUIET_WINDOW std::chrono::milliseconds(75)
 
 using json = nlohmann::json;
 
+// "injectionMode" of an application
+enum class InjectionMode {
+  // Runtime.evaluate the source, V8 compiles it again on every launch
+  Evaluate,
+  // compile with vm.Script and reuse the V8 code cache of an earlier launch
+  CodeCache
+};
+
 typedef struct application_t {
   std::string name;
   std::string directory;
   std::string style;
   std::string script;
   bool removeCSP;
+  AttachPolicy attach;
+  InjectionMode injectionMode = InjectionMode::Evaluate;
+  // "minify", the stylesheet is minified before it is published
+  bool minify = false;
 
-  std::string get_style();
-  std::string get_script();
+  std::string get_style() const;
+  // null if there is no script
+  FileContents get_script() const;
 } Application, *PApplication;
 
+// what a reload changed about an application, ApplicationChange::fields
+enum ApplicationField : unsigned {
+  APP_DIRECTORY = 1 << 0,
+  APP_STYLE = 1 << 1,
+  APP_SCRIPT = 1 << 2,
+  APP_REMOVE_CSP = 1 << 3,
+  APP_ATTACH = 1 << 4,
+  APP_INJECTION_MODE = 1 << 5,
+  APP_MINIFY = 1 << 6,
+};
+
+typedef struct application_change_t {
+  Application before;
+  Application after;
+  unsigned fields;
+} ApplicationChange;
+
+// Applications are matched by executable name, renaming one is a removal
+// and an addition
+typedef struct config_diff_t {
+  std::vector<Application> added;
+  std::vector<Application> removed;
+  std::vector<ApplicationChange> changed;
+
+  bool empty() const {
+    return added.empty() && removed.empty() && changed.empty();
+  }
+} ConfigDiff;
+
 template <>
 struct std::formatter<application_t> : std::formatter<std::string_view> {
   template <class FormatContext>
@@ -34,25 +90,80 @@ struct std::formatter<application_t> : std::formatter<std::string_view> {
   }
 };
 
+// The applications of one load of the config, indexed by executable name and
+// directory. A snapshot is never modified once published, readers on any
+// thread can hold on to one without locking while a reload publishes the
+// next.
+class ConfigSnapshot {
+ public:
+  ConfigSnapshot(std::vector<Application> applications = {});
+  ConfigSnapshot(const ConfigSnapshot&) = delete;
+  ConfigSnapshot& operator=(const ConfigSnapshot&) = delete;
+
+  const std::vector<Application> applications;
+
+  // null if there is no such application
+  const Application* by_executable(const std::string& executable) const;
+  const Application* by_directory(const std::string& directory) const;
+  bool watches(const std::string& executable) const {
+    return byExecutable.contains(executable);
+  }
+
+  ConfigDiff diff(const ConfigSnapshot& next) const;
+
+ private:
+  // into applications, the first application wins on duplicates
+  std::unordered_map<std::string, const Application*> byExecutable;
+  std::unordered_map<std::string, const Application*> byDirectory;
+};
+
 class Config {
  public:
   std::filesystem::path config_directory;
   std::filesystem::path styles_directory;
   std::filesystem::path scripts_directory;
+  std::filesystem::path cache_directory;
   std::filesystem::path config_file;
   json config{};
 
-  std::set<std::string> watchedExecutables;
-  std::vector<Application> applications;
+  // "loaderWorkers", number of processes attached to concurrently
+  unsigned int loaderWorkers = DEFAULT_LOADER_WORKERS;
+  // "serverWorkers", WebSocket server loops, each on its own thread. Not on
+  // Windows, read at startup only.
+  unsigned int serverWorkers = DEFAULT_SERVER_WORKERS;
+  // "watchQuietWindow" (ms), how long a watched file has to go without
+  // events before it is read
+  std::chrono::milliseconds watchQuietWindow = DEFAULT_WATCH_QUIET_WINDOW;
+  // "unixSocket", clients connect over SOCKET_FILE instead of the TCP port
+  // where they can. Not on Windows, read at startup only.
+  bool unixSocket = false;
+  // "sharedStyles", clients read large stylesheets from shared memory
+  // instead of the socket. Not on Windows, read at startup only.
+  bool sharedStyles = false;
 
-  void load_file(bool silent = false);
+  // returns what changed since the previous load, on the first one every
+  // application is added
+  ConfigDiff load_file(bool silent = false);
   void save_file();
   void set_config_directory(std::string& configDirectory);
-  Application& get_application_by_directory(const std::string& directory);
-  Application& get_application_by_executable(const std::string& executable);
+  // the applications as of the last load, swapped as a whole on reload
+  std::shared_ptr<const ConfigSnapshot> snapshot() const {
+    return current.load();
+  }
+  // copies out of the current snapshot, throw if there is no such
+  // application
+  Application get_application_by_directory(const std::string& directory);
+  Application get_application_by_executable(const std::string& executable);
 
  private:
-  void load_applications();
+  std::atomic<std::shared_ptr<const ConfigSnapshot>> current =
+      std::make_shared<const ConfigSnapshot>();
+
+  ConfigDiff load_applications();
+  // "logLevel" for every category, "logLevels" per category:
+  //   "logLevel": "info", "logLevels": { "watcher": "debug" }
+  void load_log_levels();
+  void create_application_directories(const Application& app);
 };
 
 extern std::unique_ptr<Config> gConfig;
@@ -0,0 +1,170 @@
+#define LOG_CATEGORY LogCategory::Watcher
+
+#include "filecache.hpp"
+
+#ifdef _WIN32
+  #include <Windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+
+  #include <cerrno>
+#endif
+
+#include <algorithm>
+
+#include "log.hpp"
+
+// a file that keeps changing while it is read is returned as last read
+#define READ_ATTEMPTS 3
+
+std::unique_ptr<FileCache> gFileCache;
+
+namespace {
+#ifdef _WIN32
+  void fill_identity(const BY_HANDLE_FILE_INFORMATION& info, uint64_t& device,
+                     uint64_t& index, uint64_t& size, int64_t& writeTime) {
+    device = info.dwVolumeSerialNumber;
+    index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) |
+            info.nFileIndexLow;
+    size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) |
+           info.nFileSizeLow;
+    writeTime = (static_cast<int64_t>(info.ftLastWriteTime.dwHighDateTime)
+                 << 32) |
+                info.ftLastWriteTime.dwLowDateTime;
+  }
+
+  // shared with everyone, editors must still be able to save over the file
+  HANDLE open_shared(const std::filesystem::path& path, DWORD access) {
+    return CreateFileW(path.c_str(), access,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  }
+#else
+  void fill_identity(const struct stat& st, uint64_t& device, uint64_t& index,
+                     uint64_t& size, int64_t& writeTime) {
+    device = st.st_dev;
+    index = st.st_ino;
+    size = st.st_size;
+    writeTime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                st.st_mtim.tv_nsec;
+  }
+#endif
+}  // namespace
+
+FileContents FileCache::get(const std::filesystem::path& path) {
+  auto key = path.lexically_normal().string();
+  FileIdentity identity;
+  if (!identify(path, identity)) {
+    std::lock_guard<std::mutex> lock(m);
+    entries.erase(key);
+    return nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto it = entries.find(key);
+    if (it != entries.end() && it->second.identity == identity)
+      return it->second.contents;
+  }
+
+  // read outside the lock, other files shouldn't wait for it
+  auto contents = read(path, identity);
+  if (contents == nullptr) return nullptr;
+  DbgLog("Read {} ({} bytes)", key, contents->size());
+
+  std::lock_guard<std::mutex> lock(m);
+  entries.insert_or_assign(key, Entry{identity, contents});
+  return contents;
+}
+
+void FileCache::invalidate(const std::filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(m);
+  entries.erase(path.lexically_normal().string());
+}
+
+#ifdef _WIN32
+bool FileCache::identify(const std::filesystem::path& path,
+                         FileIdentity& identity) {
+  HANDLE file = open_shared(path, FILE_READ_ATTRIBUTES);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  BY_HANDLE_FILE_INFORMATION info;
+  bool ok = GetFileInformationByHandle(file, &info);
+  CloseHandle(file);
+  if (!ok) return false;
+  fill_identity(info, identity.device, identity.index, identity.size,
+                identity.writeTime);
+  return true;
+}
+
+FileContents FileCache::read(const std::filesystem::path& path,
+                             FileIdentity& identity) {
+  HANDLE file = open_shared(path, GENERIC_READ);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+  std::string contents;
+  for (int attempt = 0; attempt < READ_ATTEMPTS; ++attempt) {
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info)) break;
+    fill_identity(info, identity.device, identity.index, identity.size,
+                  identity.writeTime);
+
+    contents.resize(identity.size);
+    size_t total = 0;
+    SetFilePointer(file, 0, nullptr, FILE_BEGIN);
+    while (total < contents.size()) {
+      DWORD n = 0;
+      auto want = static_cast<DWORD>(
+          std::min<size_t>(contents.size() - total, 1 << 30));
+      if (!ReadFile(file, contents.data() + total, want, &n, nullptr) ||
+          n == 0)
+        break;
+      total += n;
+    }
+    contents.resize(total);
+    // truncated while we read it, or grown since
+    if (total == identity.size) break;
+  }
+  CloseHandle(file);
+  return std::make_shared<const std::string>(std::move(contents));
+}
+#else
+bool FileCache::identify(const std::filesystem::path& path,
+                         FileIdentity& identity) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  fill_identity(st, identity.device, identity.index, identity.size,
+                identity.writeTime);
+  return true;
+}
+
+FileContents FileCache::read(const std::filesystem::path& path,
+                             FileIdentity& identity) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+
+  std::string contents;
+  for (int attempt = 0; attempt < READ_ATTEMPTS; ++attempt) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) break;
+    fill_identity(st, identity.device, identity.index, identity.size,
+                  identity.writeTime);
+
+    contents.resize(identity.size);
+    size_t total = 0;
+    while (total < contents.size()) {
+      auto n = pread(fd, contents.data() + total, contents.size() - total,
+                     static_cast<off_t>(total));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      total += n;
+    }
+    contents.resize(total);
+    // truncated while we read it, or grown since
+    if (total == identity.size) break;
+  }
+  close(fd);
+  return std::make_shared<const std::string>(std::move(contents));
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef FILECACHE_HPP
+#define FILECACHE_HPP
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// the contents of a file, shared by every reader until the file changes
+using FileContents = std::shared_ptr<const std::string>;
+
+// Contents of the style and script files, read once and handed out as shared
+// immutable buffers. Every get() checks the file's size, mtime and identity
+// (inode, or file index on Windows) with one stat and only reads it again
+// once any of them changed, so a file replaced by rename or truncated is
+// picked up and readers still holding the old buffer keep a consistent copy.
+//
+// The files are read rather than memory-mapped: a mapping of a file that is
+// truncated underneath it faults on access, and on Windows an open mapping
+// keeps editors from truncating or replacing the file at all.
+class FileCache {
+ public:
+  // null if path can't be read
+  FileContents get(const std::filesystem::path& path);
+  void invalidate(const std::filesystem::path& path);
+
+ private:
+  typedef struct file_identity_t {
+    uint64_t device = 0;
+    uint64_t index = 0;
+    uint64_t size = 0;
+    int64_t writeTime = 0;
+
+    bool operator==(const file_identity_t&) const = default;
+  } FileIdentity;
+
+  typedef struct entry_t {
+    FileIdentity identity;
+    FileContents contents;
+  } Entry;
+
+  std::mutex m;
+  std::unordered_map<std::string, Entry> entries;
+
+  static bool identify(const std::filesystem::path& path,
+                       FileIdentity& identity);
+  // identity is of the file as it was read
+  static FileContents read(const std::filesystem::path& path,
+                           FileIdentity& identity);
+};
+
+extern std::unique_ptr<FileCache> gFileCache;
+
+#endif /* FILECACHE_HPP */
@@ -0,0 +1,158 @@
+#include "log.hpp"
+
+#include <cstdlib>
+#include <iterator>
+#include <string>
+
+namespace {
+  constexpr std::array<std::string_view, 5> levelNames = {
+      "debug", "info", "warn", "error", "off"};
+  constexpr std::array<std::string_view,
+                       static_cast<size_t>(LogCategory::Count)>
+      categoryNames = {"general", "config", "watcher", "loader", "server"};
+
+  // keeps the ring alive for the drain thread once its thread exits
+  struct RingOwner {
+    std::shared_ptr<LogRing> ring;
+    ~RingOwner() {
+      if (ring != nullptr) ring->orphaned = true;
+    }
+  };
+
+  void append_record(std::string& out, const LogRecord& record) {
+    // UTC time of day
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  record.time.time_since_epoch())
+                  .count() %
+              (24 * 60 * 60 * 1000);
+    std::format_to(std::back_inserter(out),
+                   "[{:02}:{:02}:{:02}.{:03}] [{}] [{}] ", ms / 3600000,
+                   ms / 60000 % 60, ms / 1000 % 60, ms % 1000,
+                   log_level_name(record.level),
+                   log_category_name(record.category));
+    if (record.level == LogLevel::Debug)
+      std::format_to(std::back_inserter(out), "[{}:{}] ", record.function,
+                     record.line);
+    out.append(record.text, record.length);
+    if (record.truncated) out.append("...");
+    out += '\n';
+  }
+}  // namespace
+
+std::string_view log_level_name(LogLevel level) {
+  return levelNames[static_cast<size_t>(level)];
+}
+
+std::string_view log_category_name(LogCategory category) {
+  return categoryNames[static_cast<size_t>(category)];
+}
+
+bool parse_log_level(std::string_view name, LogLevel& level) {
+  for (size_t i = 0; i < levelNames.size(); ++i) {
+    if (levelNames[i] == name) {
+      level = static_cast<LogLevel>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parse_log_category(std::string_view name, LogCategory& category) {
+  for (size_t i = 0; i < categoryNames.size(); ++i) {
+    if (categoryNames[i] == name) {
+      category = static_cast<LogCategory>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+Logger& Logger::instance() {
+  // never destroyed, threads that outlive main() may still log
+  static Logger* logger = new Logger();
+  return *logger;
+}
+
+Logger::Logger() {
+  set_level(DEFAULT_LOG_LEVEL);
+  drainer = std::thread(&Logger::drain_loop, this);
+  drainer.detach();
+  // what was logged right before exit() still gets written
+  std::atexit([] { Logger::instance().flush(); });
+}
+
+void Logger::set_level(LogLevel level) {
+  for (auto& l : levels) l.store(level, std::memory_order_relaxed);
+}
+
+void Logger::set_level(LogCategory category, LogLevel level) {
+  levels[static_cast<size_t>(category)].store(level,
+                                              std::memory_order_relaxed);
+}
+
+void Logger::flush() {
+  std::unique_lock<std::mutex> lock(m);
+  auto ticket = ++flushRequested;
+  c.notify_all();
+  c.wait(lock, [&] { return flushed >= ticket; });
+}
+
+LogRing& Logger::ring() {
+  thread_local RingOwner owner;
+  if (owner.ring == nullptr) {
+    owner.ring = std::make_shared<LogRing>();
+    std::lock_guard<std::mutex> lock(m);
+    rings.push_back(owner.ring);
+  }
+  return *owner.ring;
+}
+
+void Logger::drain_loop() {
+  std::unique_lock<std::mutex> lock(m);
+  while (true) {
+    // polled, waking the drain thread on every record would cost the
+    // logging thread a syscall
+    c.wait_for(lock, LOG_DRAIN_INTERVAL,
+               [&] { return flushRequested > flushed; });
+    auto ticket = flushRequested;
+    lock.unlock();
+    drain();
+    lock.lock();
+    flushed = ticket;
+    c.notify_all();
+  }
+}
+
+void Logger::drain() {
+  std::vector<std::shared_ptr<LogRing>> current;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    // rings of exited threads go once they are empty
+    std::erase_if(rings, [](const std::shared_ptr<LogRing>& r) {
+      return r->orphaned && r->empty();
+    });
+    current = rings;
+  }
+
+  std::string out, err;
+  for (auto& r : current) {
+    r->consume([&](const LogRecord& record) {
+      append_record(record.level >= LogLevel::Warn ? err : out, record);
+    });
+    if (auto dropped = r->dropped.exchange(0)) {
+      std::format_to(std::back_inserter(err),
+                     "[{} records dropped, a thread logged faster than they "
+                     "were written]\n",
+                     dropped);
+    }
+  }
+  // per ring in order, interleaved across threads by the drain interval
+  if (!out.empty()) {
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+  }
+  if (!err.empty()) {
+    fwrite(err.data(), 1, err.size(), stderr);
+    fflush(stderr);
+  }
+}
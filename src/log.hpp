@@ -1,36 +1,184 @@
 #ifndef LOG_HPP
 #define LOG_HPP
 
+#include <stdint.h>
+#include <stdio.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <format>
+#include <memory>
+#include <mutex>
 #include <string_view>
+#include <thread>
+#include <vector>
 
-template <typename... Args>
-inline void __print(FILE* const stream, std::string_view fmt, Args&&... args) {
-  auto str = std::vformat(fmt, std::make_format_args(args...));
-  fprintf(stream, "%s\n", str.c_str());
-}
-
+// messages longer than this are cut off
+#define LOG_RECORD_TEXT_SIZE 464
+// per thread, a thread that logs faster than they are drained drops records
+#define LOG_RING_RECORDS 256
+#define LOG_DRAIN_INTERVAL std::chrono::milliseconds(20)
 #ifdef _DEBUG
-// #ifdef _MSC_VER
-// #define __PRETTY_FUNCTION__ __FUNCTION__
-// #endif
+  #define DEFAULT_LOG_LEVEL LogLevel::Debug
+#else
+  #define DEFAULT_LOG_LEVEL LogLevel::Info
+#endif
 
-constexpr inline std::string __dbg_logctx(std::string_view file, int line,
-                                          std::string_view func) {
-  return std::format("[{}:{} {}]", file, line, func);
-}
-template <typename... Args>
-inline void __dbg_print(std::string_view file, int line, std::string_view func,
-                        std::string_view fmt, Args&&... args) {
-  auto logctx = __dbg_logctx(file, line, func);
-  auto str = std::vformat(fmt, std::make_format_args(args...));
-  __print(stdout, "{} {}", logctx, str);
-}
+enum class LogLevel : uint8_t { Debug = 0, Info, Warn, Error, Off };
 
-  #define DbgLog(fmt, ...) \
-    __dbg_print(__FILE__, __LINE__, __FUNCTION__, fmt, __VA_ARGS__)
-#else
-  #define DbgLog(fmt, ...)
+enum class LogCategory : uint8_t {
+  General = 0,
+  Config,
+  Watcher,
+  Loader,
+  Server,
+  Count
+};
+
+std::string_view log_level_name(LogLevel level);
+std::string_view log_category_name(LogCategory category);
+// false if name isn't a level / category
+bool parse_log_level(std::string_view name, LogLevel& level);
+bool parse_log_category(std::string_view name, LogCategory& category);
+
+typedef struct log_record_t {
+  std::chrono::system_clock::time_point time;
+  // string literals, the drain thread formats them
+  const char* function;
+  int line;
+  LogLevel level;
+  LogCategory category;
+  bool truncated;
+  uint16_t length;
+  char text[LOG_RECORD_TEXT_SIZE];
+} LogRecord;
+
+// One thread's records, written by that thread and read by the drain thread
+// only, so neither side locks.
+class LogRing {
+ public:
+  // null if the ring is full
+  LogRecord* reserve() {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == LOG_RING_RECORDS)
+      return nullptr;
+    return &records[head % LOG_RING_RECORDS];
+  }
+  void commit() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // drain thread only, fn is called for every record written so far
+  template <typename Fn>
+  void consume(Fn fn) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) fn(records[tail % LOG_RING_RECORDS]);
+    tail_.store(tail, std::memory_order_release);
+  }
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  std::atomic<uint64_t> dropped = 0;
+  // set once the owning thread has exited
+  std::atomic<bool> orphaned = false;
+
+ private:
+  std::array<LogRecord, LOG_RING_RECORDS> records;
+  std::atomic<uint64_t> head_ = 0;
+  std::atomic<uint64_t> tail_ = 0;
+};
+
+// Formats on the calling thread into a fixed-size record of that thread's
+// ring, nothing else: no allocation, lock or I/O. A background thread drains
+// the rings to stdout (debug, info) and stderr (warn, error), so logging at
+// debug level doesn't stall the uWS loop or an attach. __print bypasses it. Levels are set per
+// category at runtime, records below a category's level cost one atomic
+// load and their arguments aren't evaluated.
+class Logger {
+ public:
+  static Logger& instance();
+
+  bool enabled(LogCategory category, LogLevel level) const {
+    return level >= levels[static_cast<size_t>(category)].load(
+                        std::memory_order_relaxed);
+  }
+  void set_level(LogLevel level);
+  void set_level(LogCategory category, LogLevel level);
+
+  template <typename... Args>
+  void write(LogCategory category, LogLevel level, const char* function,
+             int line, std::format_string<Args...> fmt, Args&&... args) {
+    auto& r = ring();
+    auto record = r.reserve();
+    if (record == nullptr) {
+      ++r.dropped;
+      return;
+    }
+    record->time = std::chrono::system_clock::now();
+    record->function = function;
+    record->line = line;
+    record->level = level;
+    record->category = category;
+    auto result = std::format_to_n(record->text, LOG_RECORD_TEXT_SIZE, fmt,
+                                   std::forward<Args>(args)...);
+    record->truncated = result.size > LOG_RECORD_TEXT_SIZE;
+    record->length = static_cast<uint16_t>(result.out - record->text);
+    r.commit();
+  }
+
+  // blocks until everything logged so far is written
+  void flush();
+
+ private:
+  Logger();
+
+  std::array<std::atomic<LogLevel>, static_cast<size_t>(LogCategory::Count)>
+      levels;
+
+  std::mutex m;
+  std::condition_variable c;
+  std::vector<std::shared_ptr<LogRing>> rings;
+  uint64_t flushRequested = 0;
+  uint64_t flushed = 0;
+  std::thread drainer;
+
+  LogRing& ring();
+  void drain_loop();
+  void drain();
+};
+
+// Defined by a file before its first #include to file its messages under
+// another category
+#ifndef LOG_CATEGORY
+  #define LOG_CATEGORY LogCategory::General
 #endif
 
+#define __log(level, fmt, ...)                                          \
+  do {                                                                  \
+    auto& __logger = Logger::instance();                                \
+    if (__logger.enabled(LOG_CATEGORY, level))                          \
+      __logger.write(LOG_CATEGORY, level, __FUNCTION__, __LINE__, fmt   \
+                         __VA_OPT__(, ) __VA_ARGS__);                   \
+  } while (0)
+
+// Output meant for the user (CLI messages, errors) is written right away, in
+// full and without a prefix: it must not be cut off or lost to an exit() that
+// follows it
+template <typename... Args>
+inline void __print(FILE* const stream, std::format_string<Args...> fmt,
+                    Args&&... args) {
+  auto str = std::format(fmt, std::forward<Args>(args)...);
+  str += '\n';
+  fwrite(str.data(), 1, str.size(), stream);
+  fflush(stream);
+}
+#define WarnLog(fmt, ...) __log(LogLevel::Warn, fmt __VA_OPT__(, ) __VA_ARGS__)
+#define DbgLog(fmt, ...) __log(LogLevel::Debug, fmt __VA_OPT__(, ) __VA_ARGS__)
+
 #endif /* LOG_HPP */
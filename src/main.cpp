@@ -4,7 +4,9 @@
 
 #include "cli/cli.hpp"
 #include "config.hpp"
+#include "filecache.hpp"
 #include "service/service.hpp"
+#include "stylebundler.hpp"
 #include "watcher.hpp"
 
 int main(int argc, char** argv) {
@@ -22,6 +24,8 @@ int main(int argc, char** argv) {
       ->force_callback(true);
 
   gConfig = std::make_unique<Config>();
+  gFileCache = std::make_unique<FileCache>();
+  gBundler = std::make_unique<StyleBundler>();
 
   load_command_app(app);
   load_command_editconfig(app);
@@ -0,0 +1,33 @@
+#include "attach.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include "metrics.hpp"
+
+using namespace std::chrono_literals;
+
+void record_stage(AttachStage stage,
+                  std::chrono::steady_clock::duration elapsed, int attempts,
+                  bool reached) {
+  Metrics::instance().stage(stage, elapsed, attempts, reached);
+}
+
+std::chrono::milliseconds backoff_delay(const BackoffPolicy& policy,
+                                        int attempt) {
+  thread_local std::mt19937 rng{std::random_device{}()};
+
+  double delay = static_cast<double>(policy.initialDelay.count());
+  for (int i = 0; i < attempt && delay < policy.maxDelay.count(); ++i)
+    delay *= policy.multiplier;
+
+  if (policy.jitter > 0) {
+    std::uniform_real_distribution<double> dist(1.0 - policy.jitter,
+                                                1.0 + policy.jitter);
+    delay *= dist(rng);
+  }
+  delay = std::min(delay, static_cast<double>(policy.maxDelay.count()));
+  // never spin
+  return std::max(std::chrono::milliseconds(static_cast<int64_t>(delay)),
+                  1ms);
+}
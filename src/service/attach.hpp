@@ -0,0 +1,54 @@
+#ifndef SERVICE_ATTACH_HPP
+#define SERVICE_ATTACH_HPP
+
+#include <chrono>
+#include <format>
+#include <stdexcept>
+#include <thread>
+
+#include "../attachpolicy.hpp"
+#include "../log.hpp"
+
+// delay before attempt n (0-based) of a probe
+std::chrono::milliseconds backoff_delay(const BackoffPolicy& policy,
+                                        int attempt);
+
+// records a stage in the metrics, attempts is 0 for stages that aren't probed
+void record_stage(AttachStage stage,
+                  std::chrono::steady_clock::duration elapsed, int attempts,
+                  bool reached);
+
+// Polls probe until it returns true, backing off between attempts as
+// configured for stage. Throws if the deadline passes first.
+template <typename Probe>
+void await_stage(AttachStage stage, const AttachPolicy& policy, Probe probe) {
+  const auto& p = policy[stage];
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + p.deadline;
+
+  for (int attempt = 0;; ++attempt) {
+    if (probe()) {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      record_stage(stage, elapsed, attempt + 1, true);
+      DbgLog("Attach stage {} reached after {} attempts ({}ms)", stage,
+             attempt + 1,
+             std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                 .count());
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      record_stage(stage, now - start, attempt + 1, false);
+      throw std::runtime_error(std::format(
+          "{} not reached within {}ms ({} attempts)", stage,
+          p.deadline.count(), attempt + 1));
+    }
+
+    auto delay = std::min<std::chrono::steady_clock::duration>(
+        backoff_delay(p, attempt), deadline - now);
+    std::this_thread::sleep_for(delay);
+  }
+}
+
+#endif /* SERVICE_ATTACH_HPP */
@@ -0,0 +1,303 @@
+#define LOG_CATEGORY LogCategory::Loader
+
+#include "cdp.hpp"
+
+#include <curl/websockets.h>
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "../log.hpp"
+
+#define RECV_CHUNK_SIZE 16384
+
+namespace {
+  constexpr std::string_view closedReply =
+      R"({"error":{"message":"session closed"}})";
+
+  CdpMessage closed_message() {
+    CdpMessage msg;
+    msg.error = true;
+    msg.raw = closedReply;
+    return msg;
+  }
+}  // namespace
+
+CdpLoop::CdpLoop() {
+  uv_loop_init(&loop);
+  uv_async_init(&loop, &async, &CdpLoop::on_async);
+  async.data = this;
+  thread = std::thread([this] { uv_run(&loop, UV_RUN_DEFAULT); });
+}
+
+CdpLoop::~CdpLoop() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stopping = true;
+  }
+  uv_async_send(&async);
+  thread.join();
+
+  // Shut down whatever sessions are left so the loop can be released. The
+  // loop thread is gone, so this thread may touch them. Their close callbacks
+  // drop the references keeping them alive once the loop runs.
+  uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
+  uv_walk(
+      &loop,
+      [](uv_handle_t* handle, void*) {
+        if (uv_is_closing(handle)) return;
+        // every other handle is a session's poll handle
+        static_cast<CdpSession*>(handle->data)->shutdown();
+      },
+      nullptr);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  uv_loop_close(&loop);
+}
+
+void CdpLoop::post(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    posted.push_back(std::move(fn));
+  }
+  uv_async_send(&async);
+}
+
+void CdpLoop::on_async(uv_async_t* handle) {
+  auto self = static_cast<CdpLoop*>(handle->data);
+
+  std::vector<std::function<void()>> fns;
+  bool stop;
+  {
+    std::lock_guard<std::mutex> lock(self->m);
+    fns.swap(self->posted);
+    stop = self->stopping;
+  }
+  for (auto& fn : fns) fn();
+  if (stop) uv_stop(&self->loop);
+}
+
+std::shared_ptr<CdpSession> CdpSession::connect(CdpLoop& loop,
+                                                const std::string& wsUrl) {
+  CURL* req = curl_easy_init();
+  curl_easy_setopt(req, CURLOPT_URL, wsUrl.c_str());
+  curl_easy_setopt(req, CURLOPT_CONNECT_ONLY, 2L /* WebSocket */);
+  auto res = curl_easy_perform(req);
+  if (res != CURLE_OK) {
+    curl_easy_cleanup(req);
+    throw std::runtime_error(std::format("WebSocket handshake failed: {}",
+                                         curl_easy_strerror(res)));
+  }
+
+  // not make_shared, the constructor is private
+  auto session = std::shared_ptr<CdpSession>(new CdpSession(loop, req));
+  loop.post([session] { session->start(); });
+  return session;
+}
+
+CdpSession::CdpSession(CdpLoop& loop, CURL* req)
+    : loop(loop), req(req), closedFuture(closedPromise.get_future().share()) {}
+
+CdpSession::~CdpSession() {
+  if (req != nullptr) curl_easy_cleanup(req);
+}
+
+int CdpSession::send(const std::string& method, json params, Callback cb) {
+  // serialize on the calling thread, the loop thread only moves bytes
+  return send(
+      method,
+      [&](int id) {
+        return json({{"id", id}, {"method", method}, {"params", params}})
+            .dump();
+      },
+      std::move(cb));
+}
+
+int CdpSession::send(const std::string& method, const Serializer& serialize,
+                     Callback cb) {
+  auto id = nextId++;
+  auto payload = serialize(id);
+
+  loop.post([self = shared_from_this(), id, payload = std::move(payload),
+             cb = std::move(cb)]() mutable {
+    if (self->isClosed) {
+      if (cb) cb(closed_message());
+      return;
+    }
+    if (cb) self->pending.emplace(id, std::move(cb));
+    self->outgoing.push_back(std::move(payload));
+    self->flush();
+  });
+  return id;
+}
+
+std::future<CdpSession::json> CdpSession::call(const std::string& method,
+                                               json params) {
+  return call(method, [&](int id) {
+    return json({{"id", id}, {"method", method}, {"params", params}}).dump();
+  });
+}
+
+std::future<CdpSession::json> CdpSession::call(const std::string& method,
+                                               const Serializer& serialize) {
+  auto promise = std::make_shared<std::promise<json>>();
+  auto future = promise->get_future();
+  send(method, serialize, [promise, method](const CdpMessage& reply) {
+    try {
+      if (reply.error)
+        throw std::runtime_error(
+            std::format("{} failed: {}", method, reply.raw));
+      promise->set_value(reply.parse());
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return future;
+}
+
+void CdpSession::close() {
+  loop.post([self = shared_from_this()] {
+    if (self->isClosed) return;
+    size_t sent;
+    curl_ws_send(self->req, "", 0, &sent, 0, CURLWS_CLOSE);
+    self->shutdown();
+  });
+}
+
+void CdpSession::start() {
+  curl_socket_t sock;
+  if (curl_easy_getinfo(req, CURLINFO_ACTIVESOCKET, &sock) != CURLE_OK ||
+      sock == CURL_SOCKET_BAD) {
+    isClosed = true;
+    closedPromise.set_value();
+    return;
+  }
+
+  uv_poll_init_socket(loop.get(), &poll, sock);
+  poll.data = this;
+  self = shared_from_this();
+  update_poll();
+
+  // curl may have read frames along with the handshake response
+  receive();
+}
+
+void CdpSession::update_poll() {
+  if (isClosed) return;
+  int events = UV_READABLE | (outgoing.empty() ? 0 : UV_WRITABLE);
+  if (events == pollEvents) return;
+  pollEvents = events;
+  uv_poll_start(&poll, events, &CdpSession::on_poll);
+}
+
+void CdpSession::on_poll(uv_poll_t* handle, int status, int events) {
+  auto session = static_cast<CdpSession*>(handle->data);
+  if (status < 0) {
+    DbgLog("Inspector socket error: {}", uv_strerror(status));
+    session->shutdown();
+    return;
+  }
+  if (events & UV_WRITABLE) session->flush();
+  if (events & UV_READABLE) session->receive();
+}
+
+void CdpSession::flush() {
+  while (!isClosed && !outgoing.empty()) {
+    auto& frame = outgoing.front();
+    size_t sent = 0;
+    auto res = curl_ws_send(req, frame.data() + outgoingOffset,
+                            frame.size() - outgoingOffset, &sent, 0,
+                            CURLWS_TEXT);
+    outgoingOffset += sent;
+    if (res == CURLE_AGAIN) break;
+    if (res != CURLE_OK) {
+      __print(stderr, "Failed to send to v8 inspector: {}",
+              curl_easy_strerror(res));
+      shutdown();
+      return;
+    }
+    if (outgoingOffset < frame.size()) break;
+
+    outgoing.pop_front();
+    outgoingOffset = 0;
+  }
+  // wait for the socket to become writable again if we couldn't send it all
+  update_poll();
+}
+
+void CdpSession::receive() {
+  while (!isClosed) {
+    // once a frame's length is known the rest of it is received in one go,
+    // straight into the message buffer
+    auto want = std::max<size_t>(frameBytesLeft, RECV_CHUNK_SIZE);
+    size_t rlen = 0;
+    const struct curl_ws_frame* meta = nullptr;
+    auto res = curl_ws_recv(req, message.prepare(want), want, &rlen, &meta);
+    if (res == CURLE_AGAIN) return;
+    if (res != CURLE_OK || meta == nullptr || (meta->flags & CURLWS_CLOSE)) {
+      // CURLE_GOT_NOTHING: the inspector went away, usually because the
+      // bundle called process._debugEnd()
+      shutdown();
+      return;
+    }
+    // curl answers pings itself
+    if (meta->flags & (CURLWS_PING | CURLWS_PONG)) continue;
+
+    message.commit(rlen);
+    frameBytesLeft = static_cast<size_t>(meta->bytesleft);
+    if (meta->bytesleft == 0 && !(meta->flags & CURLWS_CONT)) {
+      dispatch(message.view());
+      message.clear();
+    }
+  }
+}
+
+void CdpSession::dispatch(std::string_view msg) {
+  DbgLog("Message from v8 inspector: {}", msg);
+
+  CdpMessage parsed;
+  if (!parse_cdp_message(msg, parsed)) {
+    __print(stderr, "Failed to parse message from v8 inspector: {}",
+            msg.substr(0, 256));
+    return;
+  }
+
+  try {
+    if (parsed.id >= 0) {
+      auto it = pending.find(parsed.id);
+      if (it == pending.end()) return;
+      auto cb = std::move(it->second);
+      pending.erase(it);
+      cb(parsed);
+    } else if (!parsed.method.empty() && onEvent) {
+      onEvent(parsed);
+    }
+  } catch (const std::exception& ex) {
+    __print(stderr, "Failed to handle message from v8 inspector: {}",
+            ex.what());
+  }
+}
+
+void CdpSession::shutdown() {
+  if (isClosed) return;
+  isClosed = true;
+
+  auto callbacks = std::move(pending);
+  pending.clear();
+  outgoing.clear();
+
+  uv_poll_stop(&poll);
+  uv_close(reinterpret_cast<uv_handle_t*>(&poll), &CdpSession::on_close);
+
+  auto error = closed_message();
+  for (auto& [id, cb] : callbacks) cb(error);
+}
+
+void CdpSession::on_close(uv_handle_t* handle) {
+  auto session = static_cast<CdpSession*>(handle->data);
+  curl_easy_cleanup(session->req);
+  session->req = nullptr;
+  session->closedPromise.set_value();
+  // may destroy the session
+  auto self = std::move(session->self);
+}
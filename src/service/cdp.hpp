@@ -0,0 +1,123 @@
+#ifndef SERVICE_CDP_HPP
+#define SERVICE_CDP_HPP
+
+#include <curl/curl.h>
+#include <uv.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cdpmessage.hpp"
+
+// Runs a libuv loop on its own thread. All CdpSessions of a loader share one
+// CdpLoop and are only touched from its thread.
+class CdpLoop {
+ public:
+  CdpLoop();
+  ~CdpLoop();
+
+  // runs fn on the loop thread, callable from any thread
+  void post(std::function<void()> fn);
+  uv_loop_t* get() { return &loop; }
+
+ private:
+  uv_loop_t loop;
+  uv_async_t async;
+  std::thread thread;
+
+  std::mutex m;
+  std::vector<std::function<void()>> posted;
+  bool stopping = false;
+
+  static void on_async(uv_async_t* handle);
+};
+
+// Chrome DevTools Protocol client for one inspector WebSocket. Commands can
+// be sent from any thread without waiting for earlier replies; replies are
+// matched to their command by id and handed to the command's callback on the
+// loop thread.
+class CdpSession : public std::enable_shared_from_this<CdpSession> {
+  friend class CdpLoop;
+
+ public:
+  using json = nlohmann::json;
+  using Callback = std::function<void(const CdpMessage& reply)>;
+  // produces the whole command text for the id it is assigned
+  using Serializer = std::function<std::string(int id)>;
+
+  // Performs the WebSocket handshake on the calling thread, then hands the
+  // connection to loop. Throws if the handshake fails.
+  static std::shared_ptr<CdpSession> connect(CdpLoop& loop,
+                                             const std::string& wsUrl);
+  ~CdpSession();
+
+  // Queues a command, cb (if any) receives the reply. If the session closes
+  // first cb receives an error reply instead.
+  int send(const std::string& method, json params = json::object(),
+           Callback cb = nullptr);
+  // like send(), but parses the whole reply. The future throws if the reply
+  // is an error.
+  std::future<json> call(const std::string& method,
+                         json params = json::object());
+
+  // For commands serialized ahead of time, serialize is called on the
+  // calling thread with the command's id. method is only used in messages.
+  int send(const std::string& method, const Serializer& serialize,
+           Callback cb = nullptr);
+  std::future<json> call(const std::string& method,
+                         const Serializer& serialize);
+
+  // ready once the connection is gone, for whatever reason
+  std::shared_future<void> closed() const { return closedFuture; }
+  void close();
+
+  // messages without an id (CDP events), called on the loop thread. Set it
+  // before sending anything.
+  std::function<void(const CdpMessage& event)> onEvent;
+
+ private:
+  CdpSession(CdpLoop& loop, CURL* req);
+
+  CdpLoop& loop;
+  CURL* req;
+  uv_poll_t poll;
+  int pollEvents = 0;
+  // keeps us alive while the poll handle is open
+  std::shared_ptr<CdpSession> self;
+
+  std::atomic<int> nextId = 0;
+  std::unordered_map<int, Callback> pending;
+
+  std::deque<std::string> outgoing;
+  size_t outgoingOffset = 0;
+
+  CdpReceiveBuffer message;
+  // bytes of the current frame curl still has for us
+  size_t frameBytesLeft = 0;
+
+  bool isClosed = false;
+  std::promise<void> closedPromise;
+  std::shared_future<void> closedFuture;
+
+  // loop thread only
+  void start();
+  void flush();
+  void receive();
+  void dispatch(std::string_view msg);
+  void update_poll();
+  void shutdown();
+
+  static void on_poll(uv_poll_t* handle, int status, int events);
+  static void on_close(uv_handle_t* handle);
+};
+
+#endif /* SERVICE_CDP_HPP */
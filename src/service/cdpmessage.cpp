@@ -0,0 +1,129 @@
+#include "cdpmessage.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// capacity kept across messages, anything larger is released after use
+#define RECEIVE_RETAIN_LIMIT (1024 * 1024)
+#define RECEIVE_MIN_CAPACITY 4096
+
+namespace {
+  using json = nlohmann::json;
+
+  class CdpMessageSax : public nlohmann::json_sax<json> {
+   public:
+    CdpMessageSax(CdpMessage& out) : out(out) {}
+
+    bool isObject = false;
+    // aborted on purpose, not a parse error
+    bool done = false;
+
+    bool null() override { return value(); }
+    bool boolean(bool) override { return value(); }
+    bool number_integer(number_integer_t v) override {
+      if (depth == 1 && expect == Expect::Id) out.id = static_cast<int>(v);
+      return value();
+    }
+    bool number_unsigned(number_unsigned_t v) override {
+      if (depth == 1 && expect == Expect::Id) out.id = static_cast<int>(v);
+      return value();
+    }
+    bool number_float(number_float_t, const string_t&) override {
+      return value();
+    }
+    bool string(string_t& v) override {
+      if (depth == 1 && expect == Expect::Method) out.method = std::move(v);
+      return value();
+    }
+    bool binary(binary_t&) override { return value(); }
+
+    bool start_object(std::size_t) override {
+      if (depth == 0) isObject = true;
+      ++depth;
+      expect = Expect::None;
+      return true;
+    }
+    bool end_object() override {
+      --depth;
+      return true;
+    }
+    bool start_array(std::size_t) override {
+      ++depth;
+      expect = Expect::None;
+      return true;
+    }
+    bool end_array() override {
+      --depth;
+      return true;
+    }
+
+    bool key(string_t& k) override {
+      if (depth != 1) return true;
+
+      if (k == "id") {
+        expect = Expect::Id;
+      } else if (k == "method") {
+        expect = Expect::Method;
+      } else if (k == "error") {
+        out.error = true;
+        return stop_if_identified();
+      } else if (k == "result" || k == "params") {
+        return stop_if_identified();
+      } else {
+        expect = Expect::None;
+      }
+      return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&,
+                     const nlohmann::detail::exception&) override {
+      return false;
+    }
+
+   private:
+    enum class Expect { None, Id, Method };
+
+    CdpMessage& out;
+    int depth = 0;
+    Expect expect = Expect::None;
+
+    bool value() {
+      expect = Expect::None;
+      return true;
+    }
+    // V8 puts id/method first, everything after is payload
+    bool stop_if_identified() {
+      expect = Expect::None;
+      if (out.id < 0 && out.method.empty()) return true;
+      done = true;
+      return false;
+    }
+  };
+}  // namespace
+
+bool parse_cdp_message(std::string_view raw, CdpMessage& out) {
+  out.raw = raw;
+  CdpMessageSax sax(out);
+  auto ok = json::sax_parse(raw.begin(), raw.end(), &sax);
+  return sax.isObject && (ok || sax.done);
+}
+
+char* CdpReceiveBuffer::prepare(size_t n) {
+  if (allocated - length < n) {
+    auto grown = std::max({length + n, allocated * 2,
+                           static_cast<size_t>(RECEIVE_MIN_CAPACITY)});
+    auto next = std::make_unique_for_overwrite<char[]>(grown);
+    if (length > 0) memcpy(next.get(), data.get(), length);
+    data = std::move(next);
+    allocated = grown;
+  }
+  return data.get() + length;
+}
+
+void CdpReceiveBuffer::clear() {
+  length = 0;
+  if (allocated > RECEIVE_RETAIN_LIMIT) {
+    data.reset();
+    allocated = 0;
+  }
+}
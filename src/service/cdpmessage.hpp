@@ -0,0 +1,53 @@
+#ifndef SERVICE_CDPMESSAGE_HPP
+#define SERVICE_CDPMESSAGE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+
+// The fields of a CDP message that CdpSession routes on. The rest of the
+// message is left in raw and only parsed by whoever needs it.
+typedef struct cdp_message_t {
+  // -1 for events
+  int id = -1;
+  // events only
+  std::string method;
+  bool error = false;
+  // only valid until the callback returns
+  std::string_view raw;
+
+  nlohmann::json parse() const { return nlohmann::json::parse(raw); }
+} CdpMessage;
+
+// Reads id, method and error from the top level of raw with a SAX pass. No
+// DOM is built and parsing stops at "result"/"params" once the message has
+// been identified, so large evaluate results and event payloads are skipped.
+// Returns false if raw isn't a JSON object.
+bool parse_cdp_message(std::string_view raw, CdpMessage& out);
+
+// Storage for reassembling WebSocket frames in place. curl_ws_recv writes
+// straight into prepare()'d space and the buffer is reused across messages,
+// so a message costs no allocations once the buffer has grown to size.
+class CdpReceiveBuffer {
+ public:
+  // at least n writable bytes past the current contents
+  char* prepare(size_t n);
+  void commit(size_t n) { length += n; }
+
+  std::string_view view() const { return {data.get(), length}; }
+  size_t size() const { return length; }
+  size_t capacity() const { return allocated; }
+
+  // Empties the buffer. Storage that grew past the retain limit for one huge
+  // message is released rather than kept for the session's lifetime.
+  void clear();
+
+ private:
+  std::unique_ptr<char[]> data;
+  size_t length = 0;
+  size_t allocated = 0;
+};
+
+#endif /* SERVICE_CDPMESSAGE_HPP */
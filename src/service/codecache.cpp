@@ -0,0 +1,94 @@
+#define LOG_CATEGORY LogCategory::Loader
+
+#include "codecache.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#include "../config.hpp"
+#include "../log.hpp"
+
+namespace {
+  // the version comes from the target, don't let it escape the directory
+  bool valid_version(const std::string& version) {
+    return !version.empty() && version.size() <= 64 &&
+           version.find("..") == std::string::npos &&
+           std::all_of(version.begin(), version.end(), [](char c) {
+             return isalnum(static_cast<unsigned char>(c)) || c == '.' ||
+                    c == '-' || c == '_';
+           });
+  }
+
+  std::filesystem::path cache_directory(const std::string& executableName,
+                                        const std::string& electronVersion) {
+    return gConfig->cache_directory / executableName / electronVersion;
+  }
+
+  std::string file_name(std::string_view kind, uint64_t sourceHash) {
+    return std::format("{}-{:016x}.cache", kind, sourceHash);
+  }
+}  // namespace
+
+std::string codecache::load(const std::string& executableName,
+                            const std::string& electronVersion,
+                            std::string_view kind, uint64_t sourceHash) {
+  if (!valid_version(electronVersion)) return "";
+
+  std::ifstream ifs(cache_directory(executableName, electronVersion) /
+                        file_name(kind, sourceHash),
+                    std::ios::binary);
+  if (!ifs) return "";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  return buf.str();
+}
+
+void codecache::store(const std::string& executableName,
+                      const std::string& electronVersion,
+                      std::string_view kind, uint64_t sourceHash,
+                      std::string_view data) {
+  if (!valid_version(electronVersion) || data.empty()) return;
+
+  auto dir = cache_directory(executableName, electronVersion);
+  auto name = file_name(kind, sourceHash);
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    __print(stderr, "Failed to create code cache directory {}: {}",
+            dir.string(), ec.message());
+    return;
+  }
+
+  // written next to the final name and renamed, a worker loading it at the
+  // same time never sees half a cache
+  auto tmp = dir / (name + ".tmp");
+  {
+    std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+    if (!ofs) {
+      __print(stderr, "Failed to write code cache {}", tmp.string());
+      return;
+    }
+  }
+  std::filesystem::rename(tmp, dir / name, ec);
+  if (ec) {
+    __print(stderr, "Failed to store code cache {}: {}",
+            (dir / name).string(), ec.message());
+    return;
+  }
+
+  auto prefix = std::string(kind) + "-";
+  for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+    auto other = entry.path().filename().string();
+    if (other != name && other.starts_with(prefix) &&
+        entry.path().extension() == ".cache")
+      std::filesystem::remove(entry.path(), ec);
+  }
+  DbgLog("Stored {} code cache for {} (Electron {}), {} bytes", kind,
+         executableName, electronVersion, data.size());
+}
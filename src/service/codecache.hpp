@@ -0,0 +1,26 @@
+#ifndef SERVICE_CODECACHE_HPP
+#define SERVICE_CODECACHE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+// V8 code caches produced by the target processes, kept under the config's
+// cache directory per executable and Electron version. V8 only checks a
+// cache against the source's length, so each file is also named after a
+// hash of the source it was compiled from and a cache of an older bundle or
+// script is never handed back. Caches are stored base64 encoded, the way
+// they come out of and go back into the target.
+namespace codecache {
+  // empty if there is no cache
+  std::string load(const std::string& executableName,
+                   const std::string& electronVersion, std::string_view kind,
+                   uint64_t sourceHash);
+  // replaces the caches of earlier sources of the same kind
+  void store(const std::string& executableName,
+             const std::string& electronVersion, std::string_view kind,
+             uint64_t sourceHash, std::string_view data);
+}  // namespace codecache
+
+#endif /* SERVICE_CODECACHE_HPP */
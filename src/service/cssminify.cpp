@@ -0,0 +1,361 @@
+#include "cssminify.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+  enum CharClass : unsigned char {
+    Plain = 0,
+    Space,
+    // starts a comment, string, escape or url(
+    Special,
+    // ends a statement or block
+    Terminator,
+  };
+
+  constexpr std::array<CharClass, 256> make_classes() {
+    std::array<CharClass, 256> classes{};
+    for (char c : {' ', '\t', '\n', '\r', '\f'})
+      classes[static_cast<unsigned char>(c)] = Space;
+    for (char c : {'/', '"', '\'', '\\', '(', ')'})
+      classes[static_cast<unsigned char>(c)] = Special;
+    for (char c : {'{', '}', ';', ':'})
+      classes[static_cast<unsigned char>(c)] = Terminator;
+    return classes;
+  }
+  constexpr auto classes = make_classes();
+
+  CharClass class_of(char c) {
+    return classes[static_cast<unsigned char>(c)];
+  }
+
+  // no whitespace is needed after these, nor before the second set
+  bool drops_space_after(char c) { return strchr("{};,>(:!", c) != nullptr; }
+  bool drops_space_before(char c) { return strchr("{};,>)!", c) != nullptr; }
+
+  bool is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+           static_cast<unsigned char>(c) >= 0x80;
+  }
+  bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  bool is_hex(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+  }
+  char lower(char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; }
+
+  bool ieq(std::string_view s, std::string_view lowercase) {
+    if (s.size() != lowercase.size()) return false;
+    for (size_t i = 0; i < s.size(); ++i)
+      if (lower(s[i]) != lowercase[i]) return false;
+    return true;
+  }
+
+  bool is_length_unit(std::string_view unit) {
+    for (auto u : {"px", "em", "rem", "ex", "ch", "vw", "vh", "vmin", "vmax",
+                   "cm", "mm", "in", "pt", "pc"})
+      if (ieq(unit, u)) return true;
+    return false;
+  }
+
+  // index after the string starting at i
+  size_t skip_string(std::string_view css, size_t i) {
+    auto quote = css[i];
+    for (++i; i < css.size(); ++i) {
+      if (css[i] == '\\') {
+        ++i;
+      } else if (css[i] == quote || css[i] == '\n') {
+        return i + 1;
+      }
+    }
+    return css.size();
+  }
+
+  // index after the unquoted url() whose '(' is at paren, or paren if the
+  // url is quoted
+  size_t skip_url(std::string_view css, size_t paren) {
+    auto arg = paren + 1;
+    while (arg < css.size() && class_of(css[arg]) == Space) ++arg;
+    if (arg < css.size() && (css[arg] == '"' || css[arg] == '\'')) return paren;
+    for (; arg < css.size(); ++arg) {
+      if (css[arg] == '\\') {
+        ++arg;
+      } else if (css[arg] == ')') {
+        return arg + 1;
+      }
+    }
+    return css.size();
+  }
+
+  // Shortens the numbers and hex colors of a declaration value, value is
+  // already minified. Anything inside parentheses is left alone, zero
+  // lengths must keep their unit in calc() and friends.
+  void shorten_value(std::string_view value, std::string& out) {
+    int depth = 0;
+    for (size_t i = 0; i < value.size();) {
+      char c = value[i];
+      if (c == '"' || c == '\'') {
+        auto end = skip_string(value, i);
+        out.append(value.substr(i, end - i));
+        i = end;
+        continue;
+      }
+      if (c == '\\') {
+        out.append(value.substr(i, 2));
+        i += 2;
+        continue;
+      }
+      // a sign belongs to the number
+      auto before = i;
+      if (before > 0 && (value[before - 1] == '-' || value[before - 1] == '+'))
+        --before;
+      bool tokenStart = before == 0 || !is_name_char(value[before - 1]);
+
+      if (tokenStart && ieq(value.substr(i, 4), "url(")) {
+        // fragments like url(#aabbcc) aren't colors
+        auto end = i + 4;
+        while (end < value.size() && value[end] != ')')
+          end = value[end] == '"' || value[end] == '\''
+                    ? skip_string(value, end)
+                    : end + 1;
+        end = std::min(end + 1, value.size());
+        out.append(value.substr(i, end - i));
+        i = end;
+        continue;
+      }
+      if (c == '(') ++depth;
+      if (c == ')' && depth > 0) --depth;
+
+      if (c == '#' && tokenStart) {
+        size_t end = i + 1;
+        while (end < value.size() && is_name_char(value[end])) ++end;
+        auto hex = value.substr(i + 1, end - i - 1);
+        bool allHex = hex.size() == 6 || hex.size() == 8;
+        for (char h : hex) allHex = allHex && is_hex(h);
+        bool pairs = allHex;
+        for (size_t j = 0; pairs && j < hex.size(); j += 2)
+          pairs = lower(hex[j]) == lower(hex[j + 1]);
+        out += '#';
+        for (size_t j = 0; j < hex.size(); j += pairs ? 2 : 1)
+          out += allHex ? lower(hex[j]) : hex[j];
+        i = end;
+        continue;
+      }
+
+      if ((is_digit(c) || c == '.') && tokenStart) {
+        size_t end = i;
+        while (end < value.size() && is_digit(value[end])) ++end;
+        auto integer = value.substr(i, end - i);
+        std::string_view fraction;
+        if (end + 1 < value.size() && value[end] == '.' &&
+            is_digit(value[end + 1])) {
+          auto dot = end++;
+          while (end < value.size() && is_digit(value[end])) ++end;
+          fraction = value.substr(dot + 1, end - dot - 1);
+        }
+        // exponents are rare enough to be copied as they are
+        if (integer.empty() && fraction.empty()) {
+          out += c;
+          ++i;
+          continue;
+        }
+        if (end < value.size() && (value[end] == 'e' || value[end] == 'E') &&
+            end + 1 < value.size() &&
+            (is_digit(value[end + 1]) || value[end + 1] == '+' ||
+             value[end + 1] == '-')) {
+          out.append(value.substr(i, end - i));
+          i = end;
+          continue;
+        }
+
+        while (integer.size() > 1 && integer.front() == '0')
+          integer.remove_prefix(1);
+        while (!fraction.empty() && fraction.back() == '0')
+          fraction.remove_suffix(1);
+        if (integer == "0" && !fraction.empty()) integer = {};
+
+        size_t unitEnd = end;
+        while (unitEnd < value.size() && is_name_char(value[unitEnd]))
+          ++unitEnd;
+        auto unit = value.substr(end, unitEnd - end);
+        bool zero = fraction.empty() && (integer == "0" || integer.empty());
+
+        if (zero) {
+          out += '0';
+          if (depth > 0 || !is_length_unit(unit)) out.append(unit);
+        } else {
+          out.append(integer.empty() ? "" : integer);
+          if (!fraction.empty()) out.append(".").append(fraction);
+          out.append(unit);
+        }
+        i = unitEnd;
+        continue;
+      }
+
+      out += c;
+      ++i;
+    }
+  }
+
+  class Minifier {
+   public:
+    explicit Minifier(std::string_view css) : css(css) {
+      out.reserve(css.size());
+    }
+
+    std::string run() {
+      size_t i = 0;
+      while (i < css.size()) {
+        // copy runs of ordinary characters in one go
+        auto run = i;
+        while (run < css.size() && class_of(css[run]) == Plain) ++run;
+        if (run > i) {
+          emit(css.substr(i, run - i));
+          i = run;
+          continue;
+        }
+
+        char c = css[i];
+        switch (class_of(c)) {
+          case Space:
+            pendingSpace = true;
+            ++i;
+            break;
+          case Terminator:
+            terminator(c);
+            ++i;
+            break;
+          default:
+            i = special(i);
+            break;
+        }
+      }
+      end_declaration();
+      return std::move(out);
+    }
+
+   private:
+    std::string_view css;
+    std::string out;
+    bool pendingSpace = false;
+    int blockDepth = 0;
+    int parenDepth = 0;
+    // of the statement being copied, in out
+    size_t statementStart = 0;
+    size_t valueStart = std::string::npos;
+    // reused for every declaration
+    std::string value;
+
+    void emit(std::string_view text) {
+      if (pendingSpace && !out.empty() && !drops_space_after(out.back()) &&
+          !drops_space_before(text.front()))
+        out += ' ';
+      pendingSpace = false;
+      out.append(text);
+    }
+
+    void terminator(char c) {
+      if (parenDepth > 0 && c != '{' && c != '}') {
+        emit(std::string_view(&c, 1));
+        return;
+      }
+      switch (c) {
+        case ':':
+          emit(":");
+          // a declaration, if the statement ends with ';' or '}'
+          if (blockDepth > 0 && valueStart == std::string::npos)
+            valueStart = out.size();
+          return;
+        case '{':
+          pendingSpace = false;
+          out += '{';
+          ++blockDepth;
+          parenDepth = 0;
+          break;
+        case ';':
+          end_declaration();
+          pendingSpace = false;
+          if (!out.empty() && out.back() != ';' && out.back() != '{')
+            out += ';';
+          break;
+        case '}':
+          end_declaration();
+          pendingSpace = false;
+          if (!out.empty() && out.back() == ';') out.pop_back();
+          out += '}';
+          if (blockDepth > 0) --blockDepth;
+          parenDepth = 0;
+          break;
+      }
+      statementStart = out.size();
+      valueStart = std::string::npos;
+    }
+
+    void end_declaration() {
+      if (valueStart == std::string::npos) return;
+      // "color :red", the space was kept in case it was a selector
+      if (valueStart >= 2 && out[valueStart - 2] == ' ') {
+        out.erase(valueStart - 2, 1);
+        --valueStart;
+      }
+      auto property =
+          std::string_view(out).substr(statementStart,
+                                       valueStart - 1 - statementStart);
+      // custom properties are token streams only their user interprets, and
+      // a flex-basis of 0 needs its unit
+      if (property.starts_with("--") || ieq(property, "flex") ||
+          ieq(property, "flex-basis")) {
+        valueStart = std::string::npos;
+        return;
+      }
+
+      value.assign(out, valueStart);
+      out.resize(valueStart);
+      shorten_value(value, out);
+      valueStart = std::string::npos;
+    }
+
+    size_t special(size_t i) {
+      char c = css[i];
+      if (c == '/' && i + 1 < css.size() && css[i + 1] == '*') {
+        auto close = css.find("*/", i + 2);
+        auto end = close == std::string_view::npos ? css.size() : close + 2;
+        if (i + 2 < css.size() && css[i + 2] == '!') {
+          emit(css.substr(i, end - i));
+        } else {
+          // a comment still separates tokens
+          pendingSpace = true;
+        }
+        return end;
+      }
+      if (c == '"' || c == '\'') {
+        auto end = skip_string(css, i);
+        emit(css.substr(i, end - i));
+        return end;
+      }
+      if (c == '\\') {
+        auto end = std::min(i + 2, css.size());
+        emit(css.substr(i, end - i));
+        return end;
+      }
+      if (c == '(') {
+        auto name = out.size();
+        while (name > 0 && is_name_char(out[name - 1])) --name;
+        if (!pendingSpace && ieq(std::string_view(out).substr(name), "url")) {
+          auto end = skip_url(css, i);
+          if (end != i) {
+            out.append(css.substr(i, end - i));
+            return end;
+          }
+        }
+        ++parenDepth;
+      }
+      if (c == ')' && parenDepth > 0) --parenDepth;
+      emit(css.substr(i, 1));
+      return i + 1;
+    }
+  };
+}  // namespace
+
+std::string minify_css(std::string_view css) { return Minifier(css).run(); }
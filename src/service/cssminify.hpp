@@ -0,0 +1,15 @@
+#ifndef SERVICE_CSSMINIFY_HPP
+#define SERVICE_CSSMINIFY_HPP
+
+#include <string>
+#include <string_view>
+
+// Minifies a stylesheet in one pass: comments (except /*! ones) go,
+// whitespace runs become one space or nothing where no token boundary
+// depends on them, the last ';' of a block is dropped, and in declaration
+// values hex colors, leading/trailing zeros and the unit of zero lengths are
+// shortened. Strings, url()s, escapes and custom property values are copied
+// as they are.
+std::string minify_css(std::string_view css);
+
+#endif /* SERVICE_CSSMINIFY_HPP */
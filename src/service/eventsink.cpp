@@ -1,9 +1,50 @@
-#include "eventsink.hpp"
-
-#include "../config.hpp"
-#include "../log.hpp"
-#include "loader.hpp"
-#include "service.hpp"
+#ifdef _WIN32
+
+  #include "eventsink.hpp"
+
+  #include <algorithm>
+  #include <chrono>
+  #include <cstdio>
+  #include <optional>
+
+  #include "service.hpp"
+
+namespace {
+  // 100ns intervals since 1601, FILETIME's unit
+  using filetime_duration =
+      std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
+
+  // CIM_DATETIME, yyyymmddHHMMSS.mmmmmmsUUU: local time, then the UTC offset
+  // in minutes
+  std::optional<std::chrono::steady_clock::time_point> parse_creation_date(
+      const wchar_t* date) {
+    SYSTEMTIME st{};
+    unsigned int micros;
+    wchar_t sign;
+    int offset;
+    if (swscanf_s(date, L"%4hu%2hu%2hu%2hu%2hu%2hu.%6u%c%3d", &st.wYear,
+                  &st.wMonth, &st.wDay, &st.wHour, &st.wMinute, &st.wSecond,
+                  &micros, &sign, 1, &offset) != 9)
+      return {};
+    FILETIME ft;
+    if (!SystemTimeToFileTime(&st, &ft)) return {};
+
+    auto local = filetime_duration(
+        (static_cast<int64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+    auto utc = local + std::chrono::microseconds(micros) -
+               std::chrono::minutes(sign == L'-' ? -offset : offset);
+
+    FILETIME nowFt;
+    GetSystemTimePreciseAsFileTime(&nowFt);
+    auto now = filetime_duration(
+        (static_cast<int64_t>(nowFt.dwHighDateTime) << 32) |
+        nowFt.dwLowDateTime);
+    // the wall clock may have been set back since
+    auto ago = std::max(now - utc, filetime_duration::zero());
+    return std::chrono::steady_clock::now() -
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(ago);
+  }
+}  // namespace
 
 ULONG EventSink::AddRef() { return InterlockedIncrement(&m_lRef); }
 
@@ -50,24 +91,22 @@ HRESULT EventSink::Indicate(long lObjectCount, IWbemClassObject** apObjArray) {
     procId = varT.uintVal;
     VariantClear(&varT);
 
+    // TIME_CREATED of the event is when WMI's polling noticed the process,
+    // the process' own CreationDate is what we want to measure from
+    std::optional<std::chrono::steady_clock::time_point> createdAt;
+    if (SUCCEEDED(apObj->Get(_bstr_t(L"CreationDate"), 0, &varT, nullptr,
+                             nullptr)) &&
+        varT.vt == VT_BSTR)
+      createdAt = parse_creation_date(varT.bstrVal);
+    VariantClear(&varT);
+
     apObj->Get(_bstr_t(L"Name"), 0, &varT, nullptr, nullptr);
     nm = varT.bstrVal;
     VariantClear(&varT);
 
     char* chExeName = _com_util::ConvertBSTRToString(nm);
 
-    if (gConfig->watchedExecutables.find(chExeName) ==
-        gConfig->watchedExecutables.end()) {
-      // we aren't watching this process
-      delete[] chExeName;
-      proc->Release();
-      continue;
-    }
-    auto app = gConfig->get_application_by_executable(chExeName);
-
-    gService->loader->enqueue({.processId = procId,
-                               .executableName = std::string(chExeName),
-                               .removeCSP = app.removeCSP});
+    gService->on_process_created(procId, chExeName, createdAt);
 
     delete[] chExeName;  // ConvertBSTRToString allocs new string
 
@@ -82,3 +121,5 @@ HRESULT EventSink::SetStatus(LONG lFlags, HRESULT hResult, BSTR strParam,
                              IWbemClassObject __RPC_FAR* pObjParam) {
   return WBEM_S_NO_ERROR;
 }
+
+#endif
@@ -1,9 +1,11 @@
 #ifndef SERVICE_EVENTSINK_HPP
 #define SERVICE_EVENTSINK_HPP
 
-#include <Wbemidl.h>
-#include <Windows.h>
-#include <comdef.h>
+#ifdef _WIN32
+
+  #include <Wbemidl.h>
+  #include <Windows.h>
+  #include <comdef.h>
 
 // https://docs.microsoft.com/en-us/windows/win32/wmisdk/example--receiving-event-notifications-through-wmi-
 class EventSink : public IWbemObjectSink {
@@ -26,4 +28,6 @@ class EventSink : public IWbemObjectSink {
             IWbemClassObject __RPC_FAR* pObjParam);
 };
 
+#endif
+
 #endif /* SERVICE_EVENTSINK_HPP */
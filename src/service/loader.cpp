@@ -1,25 +1,36 @@
+#define LOG_CATEGORY LogCategory::Loader
+
 #include "loader.hpp"
 
-#include <Windows.h>
+#ifdef _WIN32
+  #include <Windows.h>
+#endif
 #include <curl/curl.h>
-#include <curl/websockets.h>
 
 #include <chrono>
+#include <future>
 #include <nlohmann/json.hpp>
 #include <queue>
 #include <thread>
 
 #include "../config.hpp"
-#include "../js/bundle.hpp"
 #include "../log.hpp"
 #include "../util.hpp"
+#include "attach.hpp"
+#include "cdp.hpp"
+#include "codecache.hpp"
+#include "metrics.hpp"
 #include "node.hpp"
 #include "service.hpp"
 
-#define MAX_RETRIES 30
+#define INSPECTOR_PORT 9229
+// how long the lease is held after injecting for the inspector to let go of
+// its port
+#define PORT_RELEASE_TIMEOUT std::chrono::seconds(2)
+#define PORT_RELEASE_INTERVAL std::chrono::milliseconds(5)
 #define ASSERT_CURLCODE(Result_)        \
   res = Result_;                        \
-  DbgLog("{}  =  {}\n", #Result_, res); \
+  DbgLog("{}  =  {}", #Result_, res);   \
   if (res != CURLE_OK)                  \
     throw std::runtime_error(std::format("curl error {}", res));
 
@@ -28,7 +39,7 @@ using json = nlohmann::json;
 template <>
 struct std::formatter<CURLcode> : formatter<string_view> {
   template <typename Context>
-  auto format(const CURLcode& code, Context& ctx) {
+  auto format(const CURLcode& code, Context& ctx) const {
     return formatter<string_view>::format(
         std::format("{} ({})", std::to_underlying(code),
                     curl_easy_strerror(code)),
@@ -68,132 +79,95 @@ namespace {
 
     return s;
   }
-}  // namespace
 
-class Inspector {
- public:
-  Inspector(std::string wsUrl) : req(curl_easy_init()) {
-    this->wsUrl = wsUrl;
-    CURLcode res = CURLE_OK;
-    ASSERT_CURLCODE(curl_easy_setopt(req, CURLOPT_URL, wsUrl.c_str()));
-    ASSERT_CURLCODE(
-        curl_easy_setopt(req, CURLOPT_CONNECT_ONLY, 2L /* WebSocket */));
-    ASSERT_CURLCODE(curl_easy_perform(req));
-  }
-  ~Inspector() { close(); }
-  int sendRaw(json payload) {
-    CURLcode res = CURLE_OK;
-    auto id = messageId++;
-    payload["id"] = lastSentId = id;
-    auto pl = payload.dump();
-    ASSERT_CURLCODE(
-        curl_ws_send(req, pl.c_str(), pl.size(), &sent, 0, CURLWS_TEXT));
-    return id;
+#ifdef _WIN32
+  // true if something accepts connections on 127.0.0.1:port
+  bool tcp_listening(int port) {
+    CURL* req = curl_easy_init();
+    curl_easy_setopt(req, CURLOPT_URL, "http://127.0.0.1");
+    curl_easy_setopt(req, CURLOPT_PORT, port);
+    curl_easy_setopt(req, CURLOPT_CONNECT_ONLY, 1L);
+    curl_easy_setopt(req, CURLOPT_CONNECTTIMEOUT_MS, 100L);
+    auto res = curl_easy_perform(req);
+    curl_easy_cleanup(req);
+    return res == CURLE_OK;
   }
-  int send(std::string method) { return sendRaw({{"method", method}}); }
-  int send(std::string method, json params) {
-    return sendRaw({{"method", method}, {"params", params}});
+#endif
+
+  // webSocketDebuggerUrl of the first target in /json/list, empty while the
+  // inspector isn't serving targets yet
+  std::string get_debugger_url(int port) {
+    int curlCode = -1;
+    auto res = http_get("http://127.0.0.1/json/list", port, &curlCode);
+    if (curlCode != CURLE_OK) return "";
+
+    auto list = json::parse(res, nullptr, false);
+    if (!list.is_array() || list.empty() || !list[0].is_object() ||
+        !list[0].contains("webSocketDebuggerUrl") ||
+        !list[0]["webSocketDebuggerUrl"].is_string())
+      return "";
+    return list[0]["webSocketDebuggerUrl"].get<std::string>();
   }
-  bool poll() {
-    if (req == nullptr) return false;
-
-    size_t rlen;
-    struct curl_ws_frame* oMeta;
-    CURLcode res = curl_ws_recv(req, nullptr, 0, &rlen, &oMeta);
-    /*if (res != CURLE_OK && res != CURLE_AGAIN)
-      DbgLog("curl_ws_recv: {}", res);*/
-    switch (res) {
-      case CURLE_OK: {
-        if (oMeta != nullptr) {
-          if (oMeta->bytesleft) {
-            char* buf = new char[oMeta->bytesleft];
-            q.resize(oMeta->len);
-            struct curl_ws_frame* meta;
-
-            res = curl_ws_recv(req, buf, oMeta->bytesleft, &rlen, &meta);
-
-            if (res != CURLE_OK) {
-              __print(stderr, "ws error {} !!!!!!", res);
-              delete[] buf;
-              return false;
-            } else {
-              q.insert(q.begin() + meta->offset, buf, buf + rlen);
-              if (meta->bytesleft == 0) parseMessage(std::move(q));
-              delete[] buf;
-            }
-          }
-        }
-      } break;
-      case CURLE_GOT_NOTHING:
-      case CURLE_RECV_ERROR:
-        // closing
-        return false;
-      default:
-        break;
-    }
+}  // namespace
 
-    return true;
+namespace {
+  int64_t ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
   }
-  void close() {
-    if (req == nullptr) return;
-    CURLcode res = CURLE_OK;
-    ASSERT_CURLCODE(curl_ws_send(req, "", 0, &sent, 0, CURLWS_CLOSE));
-    curl_easy_cleanup(req);
-    req = nullptr;
+
+  // inject() ends the session on the way out
+  [[noreturn]] void evaluate_timed_out(CdpSession& session,
+                                        std::chrono::milliseconds timeout) {
+    record_stage(AttachStage::ScriptEvaluated, timeout, 0, false);
+    throw std::runtime_error(
+        std::format("{} not reached within {}ms", AttachStage::ScriptEvaluated,
+                    timeout.count()));
   }
-  int messageId = 0;
-  int lastSentId = -1;
-  int lastReplyId = -2;
-  json lastReply;
-
- private:
-  std::string wsUrl;
-  CURL* req;
-  std::vector<char> q;
-  size_t sent;
-
-  void parseMessage(const std::vector<char>&& vec) {
-    std::string msg(vec.data(), vec.size());
-    try {
-      auto p = json::parse(msg);
-      DbgLog("Message from v8 inspector: {}", p.dump());
-      if (p.contains("id")) {
-        lastReplyId = p["id"].get<int>();
-        lastReply = p;
-      }
-      if (!p.contains("method")) return;
-    } catch (const std::exception& ex) {
-      __print(stderr, "Failed to handle message from v8 inspector: {}",
-              ex.what());
-    }
+
+  // the session ends once the target has called process._debugEnd(), the
+  // evaluate round trip is timed from deadline - timeout
+  void await_session_end(CdpSession& session,
+                         std::chrono::steady_clock::time_point deadline,
+                         std::chrono::milliseconds timeout) {
+    if (session.closed().wait_until(deadline) != std::future_status::ready)
+      evaluate_timed_out(session, timeout);
+    record_stage(AttachStage::ScriptEvaluated,
+                 std::chrono::steady_clock::now() - (deadline - timeout), 0,
+                 true);
   }
 
-  // static cb_write(?)
-};
+  // Asks the target to close its inspector, which it otherwise keeps open
+  // after a failed attach or evaluate
+  void end_debugging(CdpSession& session) {
+    session.send("Runtime.evaluate", {{"expression", "process._debugEnd()"}});
+    session.closed().wait_for(PORT_RELEASE_TIMEOUT);
+    session.close();
+  }
+}  // namespace
 
-std::string Loader::get_jsbundle(LoaderApplication& app) {
-  json options = {{"executableName", app.executableName},
-                  {"pid", app.processId},
-                  {"removeCSP", app.removeCSP},
-                  {"port", gService->server->port}};
-  auto optionsStr = options.dump();
-  std::string preamble =
-      "(globalThis || global).electrothemeOptions = " + optionsStr + ";\n";
-  std::string bundle(jsbundle, jsbundle + jsbundle_size);
-  return preamble + bundle;
+PortLease::Guard PortLease::acquire() {
+  std::unique_lock<std::mutex> lock(m);
+  auto ticket = nextTicket++;
+  c.wait(lock, [&] { return serving == ticket; });
+  return Guard(this);
 }
 
-std::string Loader::get_scripts(LoaderApplication& app) {
-  auto app_ = gConfig->get_application_by_executable(app.executableName);
-  return app_.get_script();
+void PortLease::release() {
+  std::lock_guard<std::mutex> lock(m);
+  ++serving;
+  c.notify_all();
 }
 
 void Loader::loop() {
-  while (true) {
-    auto app = dequeue();
+  while (auto next = dequeue()) {
+    auto& app = *next;
     try {
       process_application(app);
+      Metrics::instance().injected(app.processId, true);
     } catch (const std::exception& ex) {
+      Metrics::instance().injected(app.processId, false);
       __print(stderr, "Loader failed to process {} ({}): {}",
               app.executableName, app.processId, ex.what());
     }
@@ -201,6 +175,163 @@ void Loader::loop() {
 }
 
 void Loader::process_application(LoaderApplication& app) {
+  auto start = std::chrono::steady_clock::now();
+  Metrics::instance().queue_wait(start - app.enqueuedAt);
+  auto queueWait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       start - app.enqueuedAt)
+                       .count();
+  // the attach starts here, from the process event on
+  record_stage(AttachStage::ProcessSeen,
+               start - app.createdAt.value_or(app.enqueuedAt), 0, true);
+
+  // everything that doesn't touch the inspector happens outside the lease
+  auto injection = payloads.get(app.executableName, app.removeCSP,
+                                app.injectionMode);
+
+  // Windows: node creates the debug handler file mapping
+  // Linux: SIGUSR1 terminates the process until node has installed its handler
+  await_stage(AttachStage::DebugHandlerPresent, app.attach,
+              [&] { return node_debuggable_process(app.processId); });
+
+  int64_t leaseWait, leaseHeld;
+  {
+    auto leaseRequested = std::chrono::steady_clock::now();
+    auto lease = portLease.acquire();
+    leaseWait = ms_since(leaseRequested);
+
+    auto leaseAcquired = std::chrono::steady_clock::now();
+    inject(app, injection);
+    leaseHeld = ms_since(leaseAcquired);
+  }
+
+  __print(stdout,
+          "Done injecting into process {} in {}ms (queued {}ms, waited {}ms "
+          "for the port lease, held it {}ms)",
+          app, ms_since(start), queueWait, leaseWait, leaseHeld);
+}
+
+void Loader::evaluate(LoaderApplication& app, CdpSession& session,
+                      const InjectionPayloads& payloads) {
+  auto timeout = app.attach[AttachStage::ScriptEvaluated].deadline;
+  auto start = std::chrono::steady_clock::now();
+
+  // the payloads were serialized when they were cached, only the id and pid
+  // are filled in here
+  std::future<json> scriptReply;
+  if (payloads.script) {
+    DbgLog("sending scripts");
+    scriptReply = session.call("Runtime.evaluate", [&](int id) {
+      return payloads.script->render(id, app.processId);
+    });
+  }
+
+  DbgLog("sending styles");
+  // the bundle ends the debugging session, so there is no reply to wait for
+  session.send("Runtime.evaluate", [&](int id) {
+    return payloads.bundle->render(id, app.processId);
+  });
+
+  await_session_end(session, start + timeout, timeout);
+  auto evaluated = ms_since(start);
+
+  if (scriptReply.valid()) {
+    try {
+      auto reply = scriptReply.get();
+      if (reply["result"].contains("exceptionDetails"))
+        __print(stderr, "Script for {} threw: {}", app,
+                reply["result"]["exceptionDetails"].dump());
+    } catch (const std::exception& ex) {
+      __print(stderr, "Evaluating script for {} failed: {}", app, ex.what());
+    }
+  }
+
+  __print(stdout, "Evaluated payloads for {} in {}ms", app, evaluated);
+}
+
+void Loader::evaluate_with_code_cache(LoaderApplication& app,
+                                      CdpSession& session,
+                                      const InjectionPayloads& payloads) {
+  auto timeout = app.attach[AttachStage::ScriptEvaluated].deadline;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+
+  // a code cache is only good for the V8 that made it
+  auto versionReply = session.call(
+      "Runtime.evaluate",
+      {{"expression",
+        "process.versions.electron || 'node-' + process.versions.node"},
+       {"returnByValue", true}});
+  if (versionReply.wait_until(deadline) != std::future_status::ready)
+    evaluate_timed_out(session, timeout);
+  auto version = versionReply.get()["result"]["result"].value("value", "");
+
+  typedef struct compiled_payload_t {
+    std::string_view kind;
+    std::shared_ptr<const EvaluatePayload> payload;
+    uint64_t sourceHash;
+    bool cached = false;
+    std::future<json> reply;
+  } CompiledPayload;
+
+  std::vector<CompiledPayload> compiled;
+  if (payloads.script)
+    compiled.push_back({"script", payloads.script, payloads.scriptHash});
+  compiled.push_back({"bundle", payloads.bundle, payloads.bundleHash});
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto& c : compiled) {
+    auto cache = codecache::load(app.executableName, version, c.kind,
+                                 c.sourceHash);
+    c.cached = !cache.empty();
+    c.reply = session.call("Runtime.evaluate", [&](int id) {
+      return c.payload->render(id, app.processId, cache);
+    });
+  }
+  // in this mode the bundle leaves the session open so that its result can
+  // be read back
+  session.send("Runtime.evaluate", {{"expression", "process._debugEnd()"}});
+
+  await_session_end(session, deadline, timeout);
+  auto evaluated = ms_since(start);
+
+  for (auto& c : compiled) {
+    try {
+      auto reply = c.reply.get();
+      auto& result = reply["result"];
+      if (result.contains("exceptionDetails")) {
+        __print(stderr, "The {} for {} threw: {}", c.kind, app,
+                result["exceptionDetails"].dump());
+        continue;
+      }
+
+      auto& value = result["result"]["value"];
+      auto cacheState = !c.cached                      ? "no code cache"
+                        : value.value("rejected", false) ? "code cache rejected"
+                                                         : "code cache used";
+      __print(stdout,
+              "Compiled the {} for {} in {:.1f}ms ({}), ran it in {:.1f}ms",
+              c.kind, app, value.value("compileMs", 0.0), cacheState,
+              value.value("runMs", 0.0));
+
+      auto cache = value.value("cache", "");
+      if (!cache.empty())
+        codecache::store(app.executableName, version, c.kind, c.sourceHash,
+                         cache);
+    } catch (const std::exception& ex) {
+      __print(stderr, "Evaluating the {} for {} failed: {}", c.kind, app,
+              ex.what());
+    }
+  }
+
+  __print(stdout, "Evaluated payloads for {} in {}ms (Electron {})", app,
+          evaluated, version);
+}
+
+void Loader::inject(LoaderApplication& app,
+                    const InjectionPayloads& payloads) {
+  using enum AttachStage;
+  const auto& policy = app.attach;
+
+#ifdef _WIN32
   HANDLE process =
       OpenProcess(PROCESS_CREATE_THREAD | PROCESS_QUERY_INFORMATION |
                       PROCESS_VM_OPERATION | PROCESS_VM_WRITE | PROCESS_VM_READ,
@@ -210,77 +341,80 @@ void Loader::process_application(LoaderApplication& app) {
     throw std::runtime_error("Failed to open process\n" +
                              util::get_last_error());
 
-  // TODO: Wait a second for node to create the debugger address file mapping,
-  // maybe we were too fast!
-  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
-
   node_debug_process(app.processId, process);
   CloseHandle(process);
 
-  // attempt to request 127.0.0.1:9229/json/list until it succeeds
-  int retries = 0;
-  int curlCode = -1;
-  std::string wsUrl;
-  for (int i = 0; i < MAX_RETRIES; ++i) {
-    try {
-      auto res = http_get("http://127.0.0.1/json/list", 9229, &curlCode);
-      if (curlCode != CURLE_OK) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(20));
-        continue;
+  int port = INSPECTOR_PORT;
+  auto port_in_use = [&] { return tcp_listening(port); };
+#else
+  // anything already listening belongs to the app, not to the inspector
+  auto appPorts = node_listening_ports(app.processId);
+  node_debug_process(app.processId, nullptr);
+
+  // known once the inspector listens
+  int port = 0;
+  auto port_in_use = [&] {
+    return port != 0 && node_listening_ports(app.processId).contains(port);
+  };
+#endif
+
+  // process._debugEnd() closes the port asynchronously, the next inspector
+  // would fail to bind (or we'd attach to this one again) if we let go of the
+  // lease before that
+  auto await_port_released = [&] {
+    auto released = std::chrono::steady_clock::now() + PORT_RELEASE_TIMEOUT;
+    while (port_in_use() && std::chrono::steady_clock::now() < released)
+      std::this_thread::sleep_for(PORT_RELEASE_INTERVAL);
+  };
+
+  std::shared_ptr<CdpSession> session;
+  try {
+#ifdef _WIN32
+    await_stage(InspectorListening, policy,
+                [&] { return tcp_listening(port); });
+#else
+    await_stage(InspectorListening, policy, [&] {
+      for (auto p : node_listening_ports(app.processId)) {
+        if (appPorts.contains(p)) continue;
+        port = p;
+        return true;
       }
-      auto list_json = json::parse(res);
-      wsUrl = list_json[0]["webSocketDebuggerUrl"].get<std::string>();
-    } catch (const std::exception& ex) {
-      __print(stderr,
-              "Error while attempting to acquire {}'s WebSocket URL: {}",
-              app.executableName, ex.what());
-      return;
-    }
-  }
-
-  if (curlCode != CURLE_OK)
-    throw std::runtime_error(
-        "Could not acquire WebSocket URL for process; exceeded max retries");
-
-  auto inspector = std::make_unique<Inspector>(wsUrl);
-
-  // Enable the Runtime domain to evaluate JS
-  inspector->send("Runtime.enable");
-
-  auto appScript = get_scripts(app);
-  bool sentScripts = appScript == "";
-
-  int scriptsId = -1;
-  int stylesId = -1;
-  bool lastMessageReplied = false;
-  while (inspector->poll()) {
-    // DbgLog("{} / {} / {}", inspector->messageId, inspector->lastSentId,
-    //        inspector->lastReplyId);
-    lastMessageReplied = inspector->lastReplyId == inspector->lastSentId;
-    if (lastMessageReplied) {
-      if (!sentScripts) {
-        sentScripts = true;
-        DbgLog("sending scripts");
-        inspector->send(
-            "Runtime.evaluate",
-            {
-                {"expression", appScript},
-                {"includeCommandLineAPI",
-                 true}  // so we can use CJS require to get electron.app
-            });
-      } else {
-        DbgLog("sending styles");
-        stylesId = inspector->send(
-            "Runtime.evaluate",
-            {
-                {"expression", get_jsbundle(app) + ";process._debugEnd();"},
-                {"includeCommandLineAPI",
-                 true}  // so we can use CJS require to get electron.app
-            });
-        inspector->close();
+      return false;
+    });
+    DbgLog("Inspector for {} is listening on port {}", app, port);
+#endif
+
+    std::string wsUrl;
+    await_stage(TargetListed, policy, [&] {
+      wsUrl = get_debugger_url(port);
+      return !wsUrl.empty();
+    });
+
+    await_stage(WsConnected, policy, [&] {
+      try {
+        session = CdpSession::connect(cdpLoop, wsUrl);
+        return true;
+      } catch (const std::exception& ex) {
+        DbgLog("Connecting to {} failed: {}", wsUrl, ex.what());
+        return false;
       }
+    });
+
+    // Everything is pipelined, the inspector runs commands in order anyway.
+    // Enable the Runtime domain to evaluate JS
+    session->send("Runtime.enable");
+
+    if (payloads.mode == InjectionMode::CodeCache) {
+      evaluate_with_code_cache(app, *session, payloads);
+    } else {
+      evaluate(app, *session, payloads);
     }
+  } catch (...) {
+    // the inspector is still open, the lease must not go to the next process
+    // before it is closed
+    if (session) end_debugging(*session);
+    await_port_released();
+    throw;
   }
-
-  __print(stdout, "Done injecting into process {}", app);
+  await_port_released();
 }
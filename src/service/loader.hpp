@@ -3,15 +3,34 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <format>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../config.hpp"
+#include "attach.hpp"
+#include "cdp.hpp"
+#include "payload.hpp"
 
 typedef struct loader_application_t {
   uint32_t processId;
   std::string executableName;
   bool removeCSP;
+  AttachPolicy attach;
+  InjectionMode injectionMode;
+  // when the system saw the process start, if the process source knows
+  std::optional<std::chrono::steady_clock::time_point> createdAt;
+
+  // set by Loader::enqueue
+  std::chrono::steady_clock::time_point enqueuedAt;
 } LoaderApplication, *PLoaderApplication;
 
 template <>
@@ -23,36 +42,97 @@ struct std::formatter<loader_application_t> : std::formatter<std::string_view> {
   }
 };
 
+// Node activates its inspector on the default port (9229) and only one
+// process can listen on it at a time. The lease serializes the window from
+// activating an inspector until its port is free again, granting it in
+// request order.
+class PortLease {
+ public:
+  class Guard {
+   public:
+    Guard(PortLease* lease) : lease(lease) {}
+    Guard(Guard&& other) : lease(std::exchange(other.lease, nullptr)) {}
+    ~Guard() {
+      if (lease != nullptr) lease->release();
+    }
+
+   private:
+    PortLease* lease;
+  };
+
+  // blocks until every earlier request has released the lease
+  Guard acquire();
+
+ private:
+  std::mutex m;
+  std::condition_variable c;
+  uint64_t nextTicket = 0;
+  uint64_t serving = 0;
+
+  void release();
+};
+
 class Loader {
  public:
-  Loader() : q(), m(), c() { thread = std::thread(&Loader::loop, this); }
+  Loader(unsigned int workerCount) : q(), m(), c() {
+    for (unsigned int i = 0; i < std::max(workerCount, 1u); ++i)
+      workers.emplace_back(&Loader::loop, this);
+  }
+  // lets the injections in progress finish, drops the queued ones
+  ~Loader() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    c.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
 
   void process_application(LoaderApplication& app);
+  // the application was removed from the config
+  void forget(const std::string& executableName) {
+    payloads.forget(executableName);
+  }
 
   inline void enqueue(LoaderApplication app) {
     std::lock_guard<std::mutex> lock(m);
+    app.enqueuedAt = std::chrono::steady_clock::now();
     q.push(app);
     c.notify_one();
   }
 
-  inline LoaderApplication dequeue() {
+  // empty once the loader is stopping
+  inline std::optional<LoaderApplication> dequeue() {
     std::unique_lock<std::mutex> lock(m);
-    while (q.empty()) {
+    while (q.empty() && !stopping) {
       c.wait(lock);
     }
+    if (stopping) return std::nullopt;
     auto app = q.front();
     q.pop();
     return app;
   }
 
  private:
-  std::thread thread;
+  std::vector<std::thread> workers;
   std::queue<LoaderApplication> q;
   mutable std::mutex m;
   std::condition_variable c;
+  bool stopping = false;
+
+  PortLease portLease;
+  // shared by the CDP sessions of all workers
+  CdpLoop cdpLoop;
+  PayloadCache payloads;
 
-  std::string get_jsbundle(LoaderApplication& app);
-  std::string get_scripts(LoaderApplication& app);
+  // attaches to the inspector and evaluates the payloads, the caller must
+  // hold the port lease
+  void inject(LoaderApplication& app, const InjectionPayloads& payloads);
+  // evaluate the payloads over session and wait for it to end
+  void evaluate(LoaderApplication& app, CdpSession& session,
+                const InjectionPayloads& payloads);
+  void evaluate_with_code_cache(LoaderApplication& app, CdpSession& session,
+                                const InjectionPayloads& payloads);
 
   void loop();
 };
@@ -0,0 +1,226 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <span>
+
+namespace {
+  // upper bounds, microseconds for durations: from a local probe or a proc
+  // connector event, over the /proc scan interval (250ms) and WMI's WITHIN 1
+  // on Windows, up to the evaluate deadline
+  constexpr uint64_t durationBounds[] = {
+      1000,    2500,    5000,    10000,   25000,   50000,    100000,  250000,
+      500000,  1000000, 2500000, 5000000, 10000000, 30000000, 60000000};
+  constexpr uint64_t countBounds[] = {1, 2, 3, 5, 10, 20, 50, 100, 200};
+
+  static_assert(std::size(durationBounds) <= HISTOGRAM_MAX_BUCKETS);
+  static_assert(std::size(countBounds) <= HISTOGRAM_MAX_BUCKETS);
+
+  std::span<const uint64_t> bounds_of(HistogramUnit unit) {
+    if (unit == HistogramUnit::Duration) return durationBounds;
+    return countBounds;
+  }
+
+  // observed units per exposed unit
+  double divisor_of(HistogramUnit unit) {
+    return unit == HistogramUnit::Duration ? 1e6 : 1.0;
+  }
+
+  void render_help(std::string& out, std::string_view name,
+                   std::string_view type, std::string_view help) {
+    std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n",
+                   name, help, name, type);
+  }
+
+  void render_counter(std::string& out, std::string_view name,
+                      std::string_view labels, uint64_t value) {
+    if (labels.empty()) {
+      std::format_to(std::back_inserter(out), "{} {}\n", name, value);
+      return;
+    }
+    // the labels end in a comma for the histograms' le to follow
+    labels.remove_suffix(1);
+    std::format_to(std::back_inserter(out), "{}{{{}}} {}\n", name, labels,
+                   value);
+  }
+
+  std::string stage_label(AttachStage stage) {
+    return std::format("stage=\"{}\",", attach_stage_name(stage));
+  }
+}  // namespace
+
+Histogram::Histogram(HistogramUnit unit) : unit(unit) {}
+
+void Histogram::observe(uint64_t value) {
+  auto bounds = bounds_of(unit);
+  auto i = std::lower_bound(bounds.begin(), bounds.end(), value) -
+           bounds.begin();
+  buckets[i].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::string& out, std::string_view name,
+                       std::string_view labels) const {
+  auto bounds = bounds_of(unit);
+  auto divisor = divisor_of(unit);
+  auto it = std::back_inserter(out);
+
+  // relaxed counters, a scrape racing an observation may be off by one
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    cumulative += buckets[i].load(std::memory_order_relaxed);
+    std::format_to(it, "{}_bucket{{{}le=\"{}\"}} {}\n", name, labels,
+                   bounds[i] / divisor, cumulative);
+  }
+  cumulative += buckets[bounds.size()].load(std::memory_order_relaxed);
+  std::format_to(it, "{}_bucket{{{}le=\"+Inf\"}} {}\n", name, labels,
+                 cumulative);
+
+  auto total = sum.load(std::memory_order_relaxed) / divisor;
+  auto n = count.load(std::memory_order_relaxed);
+  if (labels.empty()) {
+    std::format_to(it, "{}_sum {}\n{}_count {}\n", name, total, name, n);
+  } else {
+    labels.remove_suffix(1);
+    std::format_to(it, "{}_sum{{{}}} {}\n{}_count{{{}}} {}\n", name, labels,
+                   total, name, labels, n);
+  }
+}
+
+Metrics& Metrics::instance() {
+  // never destroyed, workers may still record while the process exits
+  static Metrics* metrics = new Metrics();
+  return *metrics;
+}
+
+void Metrics::process_seen(uint32_t pid,
+                           std::optional<clock::time_point> createdAt) {
+  auto now = clock::now();
+  if (createdAt)
+    processEvent.observe(std::max(now - *createdAt, clock::duration::zero()));
+
+  std::lock_guard<std::mutex> lock(m);
+  if (timelines.size() >= METRICS_MAX_TRACKED) {
+    auto oldest = std::min_element(
+        timelines.begin(), timelines.end(), [](const auto& a, const auto& b) {
+          return a.second.created < b.second.created;
+        });
+    timelines.erase(oldest);
+  }
+  // a reused pid starts over
+  timelines.insert_or_assign(pid,
+                             Timeline{.created = createdAt.value_or(now)});
+}
+
+void Metrics::stage(AttachStage stage, clock::duration elapsed, int attempts,
+                    bool reached) {
+  auto i = static_cast<size_t>(stage);
+  if (i >= stageCount) return;
+  if (attempts > 0) stageAttempts[i].observe(static_cast<uint64_t>(attempts));
+  if (reached) {
+    stageDuration[i].observe(elapsed);
+  } else {
+    stageFailures[i].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::injected(uint32_t pid, bool succeeded) {
+  (succeeded ? injections : injectionFailures)
+      .fetch_add(1, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(m);
+  auto it = timelines.find(pid);
+  if (it == timelines.end()) return;
+  // nothing will connect back
+  if (!succeeded) {
+    timelines.erase(it);
+    return;
+  }
+  it->second.injected = clock::now();
+}
+
+void Metrics::client_hello(uint32_t pid) {
+  auto now = clock::now();
+  std::lock_guard<std::mutex> lock(m);
+  auto it = timelines.find(pid);
+  // reconnects say HELLO again, only the first one is measured
+  if (it == timelines.end() || !it->second.injected || it->second.hello)
+    return;
+  it->second.hello = now;
+  clientHello.observe(now - *it->second.injected);
+}
+
+void Metrics::styles_applied(uint32_t pid) {
+  auto now = clock::now();
+  std::lock_guard<std::mutex> lock(m);
+  auto it = timelines.find(pid);
+  if (it == timelines.end() || !it->second.hello) return;
+  stylesApplied.observe(now - *it->second.hello);
+  timeToTheme.observe(now - it->second.created);
+  timelines.erase(it);
+}
+
+std::string Metrics::render() const {
+  std::string out;
+  out.reserve(16 * 1024);
+
+  render_help(out, "electrotheme_process_event_delay_seconds", "histogram",
+              "Time from a watched process starting until the process source "
+              "reported it.");
+  processEvent.render(out, "electrotheme_process_event_delay_seconds");
+
+  render_help(out, "electrotheme_loader_queue_wait_seconds", "histogram",
+              "Time a process waited for a loader worker.");
+  queueWait.render(out, "electrotheme_loader_queue_wait_seconds");
+
+  render_help(out, "electrotheme_attach_stage_seconds", "histogram",
+              "Time from the previous attach stage until a stage was "
+              "reached. processSeen is from the process event until a loader "
+              "worker took the process, scriptEvaluated is the evaluate round "
+              "trip.");
+  for (size_t i = 0; i < stageCount; ++i)
+    stageDuration[i].render(out, "electrotheme_attach_stage_seconds",
+                            stage_label(static_cast<AttachStage>(i)));
+
+  // processSeen and scriptEvaluated aren't probed
+  render_help(out, "electrotheme_attach_stage_attempts", "histogram",
+              "Probes until an attach stage was reached or given up on. "
+              "targetListed counts /json/list requests.");
+  for (size_t i = 1; i < stageCount - 1; ++i)
+    stageAttempts[i].render(out, "electrotheme_attach_stage_attempts",
+                            stage_label(static_cast<AttachStage>(i)));
+
+  render_help(out, "electrotheme_attach_stage_failures_total", "counter",
+              "Attaches given up on at each stage.");
+  for (size_t i = 0; i < stageCount; ++i)
+    render_counter(out, "electrotheme_attach_stage_failures_total",
+                   stage_label(static_cast<AttachStage>(i)),
+                   stageFailures[i].load(std::memory_order_relaxed));
+
+  render_help(out, "electrotheme_injections_total", "counter",
+              "Processes the loader injected into.");
+  render_counter(out, "electrotheme_injections_total", {},
+                 injections.load(std::memory_order_relaxed));
+  render_help(out, "electrotheme_injection_failures_total", "counter",
+              "Processes the loader failed to inject into, at any stage.");
+  render_counter(out, "electrotheme_injection_failures_total", {},
+                 injectionFailures.load(std::memory_order_relaxed));
+
+  render_help(out, "electrotheme_client_hello_seconds", "histogram",
+              "Time from the injection finishing until the client said "
+              "HELLO.");
+  clientHello.render(out, "electrotheme_client_hello_seconds");
+
+  render_help(out, "electrotheme_first_style_applied_seconds", "histogram",
+              "Time from the client's HELLO until it applied its first "
+              "stylesheet to a page.");
+  stylesApplied.render(out, "electrotheme_first_style_applied_seconds");
+
+  render_help(out, "electrotheme_time_to_theme_seconds", "histogram",
+              "Time from a process starting until its first page was "
+              "themed.");
+  timeToTheme.render(out, "electrotheme_time_to_theme_seconds");
+  return out;
+}
@@ -0,0 +1,109 @@
+#ifndef SERVICE_METRICS_HPP
+#define SERVICE_METRICS_HPP
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "attach.hpp"
+
+// processes whose time to theme is still being measured, the oldest is
+// dropped beyond this (they never said HELLO, or died)
+#define METRICS_MAX_TRACKED 1024
+#define HISTOGRAM_MAX_BUCKETS 16
+
+enum class HistogramUnit {
+  // observed in microseconds, exposed in seconds
+  Duration,
+  // attempts, retries and the like
+  Count
+};
+
+// Cumulative histogram with fixed buckets, safe to observe from any thread.
+class Histogram {
+ public:
+  explicit Histogram(HistogramUnit unit = HistogramUnit::Duration);
+
+  void observe(uint64_t value);
+  void observe(std::chrono::steady_clock::duration d) {
+    observe(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+  }
+
+  // appends the _bucket, _sum and _count samples, labels is either empty or
+  // `name="value",` pairs ending in a comma
+  void render(std::string& out, std::string_view name,
+              std::string_view labels = {}) const;
+
+ private:
+  HistogramUnit unit;
+  // the last bucket is +Inf
+  std::array<std::atomic<uint64_t>, HISTOGRAM_MAX_BUCKETS + 1> buckets{};
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> count = 0;
+};
+
+class CountHistogram : public Histogram {
+ public:
+  CountHistogram() : Histogram(HistogramUnit::Count) {}
+};
+
+// Where the time between an Electron process starting and its theme showing
+// goes. The loader, the process sources and the server record into the one
+// instance, the server exposes it on /metrics in the Prometheus text format.
+class Metrics {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  static Metrics& instance();
+
+  // A watched process was reported by the process source. createdAt is when
+  // the system saw it start, if the source knows.
+  void process_seen(uint32_t pid, std::optional<clock::time_point> createdAt);
+  void queue_wait(clock::duration waited) { queueWait.observe(waited); }
+  // an attach stage was reached (or given up on) elapsed after the previous
+  // one, attempts being the number of probes
+  void stage(AttachStage stage, clock::duration elapsed, int attempts,
+             bool reached);
+  void injected(uint32_t pid, bool succeeded);
+  // the injected client connected and said HELLO
+  void client_hello(uint32_t pid);
+  // the client applied its first stylesheet to a page
+  void styles_applied(uint32_t pid);
+
+  std::string render() const;
+
+ private:
+  Metrics() = default;
+
+  typedef struct timeline_t {
+    clock::time_point created;
+    std::optional<clock::time_point> injected;
+    std::optional<clock::time_point> hello;
+  } Timeline;
+
+  static constexpr size_t stageCount = static_cast<size_t>(AttachStage::Count);
+
+  Histogram processEvent;
+  Histogram queueWait;
+  std::array<Histogram, stageCount> stageDuration;
+  std::array<CountHistogram, stageCount> stageAttempts;
+  std::array<std::atomic<uint64_t>, stageCount> stageFailures{};
+  std::atomic<uint64_t> injections = 0;
+  std::atomic<uint64_t> injectionFailures = 0;
+  Histogram clientHello;
+  Histogram stylesApplied;
+  Histogram timeToTheme;
+
+  std::mutex m;
+  std::unordered_map<uint32_t, Timeline> timelines;
+};
+
+#endif /* SERVICE_METRICS_HPP */
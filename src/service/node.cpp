@@ -1,13 +1,24 @@
 #include "node.hpp"
 
-#include <Windows.h>
-#include <WtsApi32.h>
+#ifdef _WIN32
+  #include <Windows.h>
+  #include <WtsApi32.h>
+#else
+  #include <signal.h>
+
+  #include <filesystem>
+  #include <format>
+  #include <fstream>
+  #include <sstream>
+  #include <string>
+#endif
 
 #include <cstdio>
 #include <stdexcept>
 
 #include "../util.hpp"
 
+#ifdef _WIN32
 namespace {
   int GetDebugSignalHandlerMappingName(uint32_t pid, char* buf,
                                        size_t buf_len) {
@@ -61,3 +72,71 @@ void node_debug_process(uint32_t pid, void* handle) {
         "node_debug_process(): could not create debug handler thread\n" +
         util::get_last_error());
 }
+#else
+namespace {
+  // inodes of the sockets in /proc/<pid>/fd, links look like "socket:[1234]"
+  std::set<uint64_t> get_socket_inodes(uint32_t pid) {
+    std::set<uint64_t> inodes;
+    std::error_code ec;
+    for (const auto& fd : std::filesystem::directory_iterator(
+             std::format("/proc/{}/fd", pid), ec)) {
+      std::error_code lec;
+      auto target = std::filesystem::read_symlink(fd.path(), lec).string();
+      if (lec || !target.starts_with("socket:[")) continue;
+      inodes.insert(std::stoull(target.substr(8)));
+    }
+    return inodes;
+  }
+}  // namespace
+
+bool node_debuggable_process(uint32_t pid) {
+  std::ifstream ifs(std::format("/proc/{}/status", pid));
+  std::string line;
+  while (std::getline(ifs, line)) {
+    // SigCgt: 0000000000004a02 - bit (n - 1) set if signal n is caught
+    if (!line.starts_with("SigCgt:")) continue;
+    auto caught = std::stoull(line.substr(7), nullptr, 16);
+    return caught & (1ull << (SIGUSR1 - 1));
+  }
+  return false;
+}
+
+void node_debug_process(uint32_t pid, void* handle) {
+  if (kill(static_cast<pid_t>(pid), SIGUSR1) != 0)
+    throw std::runtime_error("node_debug_process(): could not send SIGUSR1\n" +
+                             util::get_last_error());
+}
+
+std::set<uint16_t> node_listening_ports(uint32_t pid) {
+  std::set<uint16_t> ports;
+  auto inodes = get_socket_inodes(pid);
+  if (inodes.empty()) return ports;
+
+  // the pid's view of the tables, correct even inside a network namespace
+  for (auto table : {"tcp", "tcp6"}) {
+    std::ifstream ifs(std::format("/proc/{}/net/{}", pid, table));
+    std::string line;
+    std::getline(ifs, line);  // header
+
+    //   sl  local_address rem_address   st tx_queue rx_queue tr tm->when
+    //   retrnsmt   uid  timeout inode
+    while (std::getline(ifs, line)) {
+      std::istringstream fields(line);
+      std::string sl, local, remote, state, queues, timer, retransmit;
+      uint32_t uid, timeout;
+      uint64_t inode;
+      if (!(fields >> sl >> local >> remote >> state >> queues >> timer >>
+            retransmit >> uid >> timeout >> inode))
+        continue;
+      // 0A = TCP_LISTEN
+      if (state != "0A" || !inodes.contains(inode)) continue;
+
+      auto colon = local.rfind(':');
+      if (colon == std::string::npos) continue;
+      ports.insert(static_cast<uint16_t>(
+          std::stoul(local.substr(colon + 1), nullptr, 16)));
+    }
+  }
+  return ports;
+}
+#endif
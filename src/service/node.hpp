@@ -2,8 +2,19 @@
 #define SERVICE_NODE_HPP
 
 #include <cstdint>
+#include <set>
 
+// Activates the inspector of a node process. On Windows this runs the debug
+// handler in the process (handle needs PROCESS_CREATE_THREAD), on Linux it
+// sends SIGUSR1 and handle is unused.
 void node_debug_process(uint32_t pid, void* handle);
+// true once node has set up its debug handler, activating the inspector
+// before that point kills the process on Linux
 bool node_debuggable_process(uint32_t pid);
 
+#ifdef __linux__
+// Local ports of the TCP sockets in LISTEN state owned by pid
+std::set<uint16_t> node_listening_ports(uint32_t pid);
+#endif
+
 #endif /* SERVICE_NODE_HPP */
@@ -0,0 +1,210 @@
+#define LOG_CATEGORY LogCategory::Loader
+
+#include "payload.hpp"
+
+#include <charconv>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+#include "../js/bundle.hpp"
+#include "../log.hpp"
+#include "../util.hpp"
+#include "service.hpp"
+
+// stand in for the pid and the code cache until render()
+#define PID_MARKER "__electrotheme_pid__"
+#define CACHE_MARKER "__electrotheme_cache__"
+
+using json = nlohmann::json;
+
+namespace {
+  void append_number(std::string& out, uint64_t n) {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), n);
+    out.append(buf, end);
+  }
+
+  std::string get_preamble(const std::string& executableName, bool removeCSP) {
+    json options = {{"executableName", executableName},
+                    {"pid", PID_MARKER},
+                    {"removeCSP", removeCSP},
+                    {"port", gService->server->port.load()}};
+    // clients fall back to the port if they can't connect to it
+    if (!gService->server->socketPath.empty())
+      options["socketPath"] = gService->server->socketPath;
+    auto optionsStr = options.dump();
+    // the pid is a number, drop the quotes around the marker
+    auto quoted = optionsStr.find("\"" PID_MARKER "\"");
+    optionsStr.replace(quoted, sizeof(PID_MARKER) + 1, PID_MARKER);
+
+    return "(globalThis || global).electrothemeOptions = " + optionsStr +
+           ";\n";
+  }
+
+  // Compiles source with vm.Script, handing it the cache in CACHE_MARKER if
+  // there is one, and runs it with the CommandLineAPI require. Evaluates to
+  // the compile and run times and, unless V8 accepted the cache, a new one
+  // for the loader to store.
+  std::string code_cache_wrapper(std::string_view kind,
+                                 const std::string& source) {
+    auto wrapped = json("(function (require) {\n" + source + "\n})").dump();
+    return R"JS((() => {
+  const { Script } = require('vm')
+  const cachedData = ')JS" CACHE_MARKER R"JS('
+  const start = process.hrtime.bigint()
+  const script = new Script()JS" +
+           wrapped + ", {\n    filename: 'electrotheme:" + std::string(kind) +
+           R"JS(',
+    cachedData: cachedData ? Buffer.from(cachedData, 'base64') : undefined,
+  })
+  const compiled = process.hrtime.bigint()
+  script.runInThisContext()(require)
+  const ran = process.hrtime.bigint()
+  const rejected = cachedData !== '' && script.cachedDataRejected === true
+  const reused = cachedData !== '' && !rejected
+  return {
+    rejected,
+    cache: reused ? '' : script.createCachedData().toString('base64'),
+    compileMs: Number(compiled - start) / 1e6,
+    runMs: Number(ran - compiled) / 1e6,
+  }
+})())JS";
+  }
+}  // namespace
+
+EvaluatePayload::EvaluatePayload(const std::string& expression,
+                                 EvaluateOptions options) {
+  json params = {{"expression", expression},
+                 {"includeCommandLineAPI",
+                  true}};  // so we can use CJS require to get electron.app
+  if (options.returnByValue) params["returnByValue"] = true;
+
+  // {"id":<id>,"method":"Runtime.evaluate","params":{...}}
+  text = "{\"id\":";
+  idAt = text.size();
+  text += ",\"method\":\"Runtime.evaluate\",\"params\":";
+  text += params.dump();
+  text += "}";
+
+  // the holes come before any user source, the first occurrence is ours
+  size_t from = idAt;
+  if (options.pid) {
+    pidAt = text.find(PID_MARKER, from);
+    if (pidAt != std::string::npos) {
+      text.erase(pidAt, sizeof(PID_MARKER) - 1);
+      from = pidAt;
+    }
+  }
+  if (options.cachedData) {
+    cacheAt = text.find(CACHE_MARKER, from);
+    if (cacheAt != std::string::npos)
+      text.erase(cacheAt, sizeof(CACHE_MARKER) - 1);
+  }
+}
+
+std::string EvaluatePayload::render(int id, uint32_t pid,
+                                    std::string_view cachedData) const {
+  std::string out;
+  out.reserve(text.size() + 24 + cachedData.size());
+  out.append(text, 0, idAt);
+  append_number(out, id);
+
+  size_t copied = idAt;
+  if (pidAt != std::string::npos) {
+    out.append(text, copied, pidAt - copied);
+    append_number(out, pid);
+    copied = pidAt;
+  }
+  if (cacheAt != std::string::npos) {
+    out.append(text, copied, cacheAt - copied);
+    // base64, nothing to escape
+    out.append(cachedData);
+    copied = cacheAt;
+  }
+  out.append(text, copied);
+  return out;
+}
+
+InjectionPayloads PayloadCache::get(const std::string& executableName,
+                                    bool removeCSP, InjectionMode mode) {
+  // one snapshot for the key and the build, a reload in between can't mix
+  // them
+  auto config = gConfig->snapshot();
+  auto app = config->by_executable(executableName);
+  if (app == nullptr)
+    throw std::runtime_error("Application with executable name \"" +
+                             executableName + "\" does not exist");
+  const auto& application = *app;
+
+  Entry key;
+  key.port = gService->server->port.load();
+  key.removeCSP = removeCSP;
+  key.mode = mode;
+  // the same buffer for as long as the file is unchanged, a missing script
+  // is cached as such until it appears
+  key.script = application.get_script();
+
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto it = entries.find(executableName);
+    if (it != entries.end()) {
+      const auto& e = it->second;
+      if (e.port == key.port && e.removeCSP == key.removeCSP &&
+          e.mode == key.mode && e.script == key.script)
+        return e.payloads;
+    }
+  }
+
+  // built outside the lock, workers attaching to other applications
+  // shouldn't wait for it
+  auto entry = build(application, key);
+  DbgLog("Built injection payloads for {} ({} bytes)", executableName,
+         entry.payloads.bundle->size() +
+             (entry.payloads.script ? entry.payloads.script->size() : 0));
+
+  std::lock_guard<std::mutex> lock(m);
+  entries.insert_or_assign(executableName, entry);
+  return entry.payloads;
+}
+
+void PayloadCache::forget(const std::string& executableName) {
+  std::lock_guard<std::mutex> lock(m);
+  entries.erase(executableName);
+}
+
+PayloadCache::Entry PayloadCache::build(const Application& application,
+                                        const Entry& key) {
+  Entry entry = key;
+  auto& payloads = entry.payloads;
+  payloads.mode = key.mode;
+
+  static const std::string noScript;
+  const auto& appScript = key.script != nullptr ? *key.script : noScript;
+  auto preamble = get_preamble(application.name, key.removeCSP);
+  std::string bundle(jsbundle, jsbundle + jsbundle_size);
+
+  if (key.mode == InjectionMode::CodeCache) {
+    // the preamble stays outside the compiled source, it differs per process
+    if (!appScript.empty()) {
+      payloads.scriptHash = util::hash(appScript);
+      payloads.script = std::make_shared<const EvaluatePayload>(
+          code_cache_wrapper("script", appScript),
+          EvaluateOptions{.cachedData = true, .returnByValue = true});
+    }
+    payloads.bundleHash = util::hash(bundle);
+    payloads.bundle = std::make_shared<const EvaluatePayload>(
+        preamble + code_cache_wrapper("bundle", bundle),
+        EvaluateOptions{
+            .pid = true, .cachedData = true, .returnByValue = true});
+    return entry;
+  }
+
+  if (!appScript.empty())
+    payloads.script = std::make_shared<const EvaluatePayload>(appScript);
+  // Kills the inspector thread in the process, freeing its port for the next
+  // process and closing our WebSocket connection
+  payloads.bundle = std::make_shared<const EvaluatePayload>(
+      preamble + bundle + ";process._debugEnd();",
+      EvaluateOptions{.pid = true});
+  return entry;
+}
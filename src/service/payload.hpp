@@ -0,0 +1,76 @@
+#ifndef SERVICE_PAYLOAD_HPP
+#define SERVICE_PAYLOAD_HPP
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../config.hpp"
+#include "../filecache.hpp"
+
+typedef struct evaluate_options_t {
+  // the expression has holes for the pid and/or a base64 V8 code cache,
+  // PID_MARKER and CACHE_MARKER in that order
+  bool pid = false;
+  bool cachedData = false;
+  bool returnByValue = false;
+} EvaluateOptions;
+
+// A Runtime.evaluate command serialized and JSON-escaped once. The command id
+// and any holes are left for render() to splice in, so sending it costs one
+// allocation and a copy however large the expression is.
+class EvaluatePayload {
+ public:
+  EvaluatePayload(const std::string& expression, EvaluateOptions options = {});
+
+  std::string render(int id, uint32_t pid,
+                     std::string_view cachedData = {}) const;
+  size_t size() const { return text.size(); }
+
+ private:
+  std::string text;
+  size_t idAt;
+  size_t pidAt = std::string::npos;
+  size_t cacheAt = std::string::npos;
+};
+
+typedef struct injection_payloads_t {
+  InjectionMode mode;
+  // null if the application has no script
+  std::shared_ptr<const EvaluatePayload> script;
+  std::shared_ptr<const EvaluatePayload> bundle;
+  // of the source compiled in the target, names the code cache files
+  uint64_t scriptHash = 0;
+  uint64_t bundleHash = 0;
+} InjectionPayloads;
+
+// The injection payloads of each application, built on first use. An entry is
+// rebuilt once the application's script file, its config or the server port
+// has changed, otherwise attaching only renders the cached payloads.
+class PayloadCache {
+ public:
+  InjectionPayloads get(const std::string& executableName, bool removeCSP,
+                        InjectionMode mode);
+  // drop the entry of an application removed from the config
+  void forget(const std::string& executableName);
+
+ private:
+  typedef struct entry_t {
+    int port;
+    bool removeCSP;
+    InjectionMode mode;
+    FileContents script;
+    InjectionPayloads payloads;
+  } Entry;
+
+  std::mutex m;
+  std::unordered_map<std::string, Entry> entries;
+
+  static Entry build(const Application& application, const Entry& key);
+};
+
+#endif /* SERVICE_PAYLOAD_HPP */
@@ -0,0 +1,17 @@
+#include "processsource.hpp"
+
+#ifdef _WIN32
+  #include "wmisource.hpp"
+#elif defined(__linux__)
+  #include "procsource.hpp"
+#endif
+
+std::unique_ptr<ProcessSource> make_process_source() {
+#ifdef _WIN32
+  return std::make_unique<WmiProcessSource>();
+#elif defined(__linux__)
+  return std::make_unique<ProcProcessSource>();
+#else
+  #error "No process source for this platform"
+#endif
+}
@@ -0,0 +1,22 @@
+#ifndef SERVICE_PROCESSSOURCE_HPP
+#define SERVICE_PROCESSSOURCE_HPP
+
+#include <memory>
+
+// Reports newly started Electron main processes to
+// Service::on_process_created. Child processes (--type=...) must already be
+// filtered out by the source.
+class ProcessSource {
+ public:
+  virtual ~ProcessSource() = default;
+
+  // throws if the source could not be set up
+  virtual void start() = 0;
+  virtual void stop() = 0;
+};
+
+// WMI on Windows, the netlink proc connector (with a /proc scanner fallback)
+// on Linux
+std::unique_ptr<ProcessSource> make_process_source();
+
+#endif /* SERVICE_PROCESSSOURCE_HPP */
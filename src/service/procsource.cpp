@@ -0,0 +1,256 @@
+#define LOG_CATEGORY LogCategory::Loader
+
+#ifdef __linux__
+
+  #include "procsource.hpp"
+
+  #include <linux/cn_proc.h>
+  #include <linux/connector.h>
+  #include <linux/netlink.h>
+  #include <poll.h>
+  #include <sys/eventfd.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+
+  #include <cerrno>
+  #include <charconv>
+  #include <chrono>
+  #include <cstring>
+  #include <filesystem>
+  #include <fstream>
+  #include <stdexcept>
+
+  #include "../config.hpp"
+  #include "../log.hpp"
+  #include "../util.hpp"
+  #include "service.hpp"
+
+  #define SCAN_INTERVAL std::chrono::milliseconds(250)
+  // the kernel acks a subscription right away if it takes it at all
+  #define SUBSCRIBE_TIMEOUT std::chrono::milliseconds(500)
+
+namespace {
+  std::optional<uint32_t> parse_pid(const std::string& str) {
+    uint32_t pid = 0;
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), pid);
+    if (ec != std::errc() || ptr != str.data() + str.size()) return {};
+    return pid;
+  }
+}  // namespace
+
+std::optional<std::string> proc::executable_name(uint32_t pid) {
+  std::error_code ec;
+  auto exe =
+      std::filesystem::read_symlink(std::format("/proc/{}/exe", pid), ec);
+  if (ec) return {};
+  return exe.filename().string();
+}
+
+bool proc::is_main_process(uint32_t pid) {
+  std::ifstream ifs(std::format("/proc/{}/cmdline", pid), std::ios::binary);
+  if (!ifs) return false;
+
+  // arguments are NUL separated
+  std::string arg;
+  while (std::getline(ifs, arg, '\0')) {
+    if (arg.starts_with("--type=")) return false;
+  }
+  return true;
+}
+
+void ProcProcessSource::start() {
+  stopEvent = eventfd(0, EFD_CLOEXEC);
+  if (stopEvent < 0)
+    throw std::runtime_error("Failed to create eventfd: " +
+                             util::get_last_error());
+
+  if (auto error = open_connector(); error == 0) {
+    DbgLog("Listening for exec events on the proc connector");
+    thread = std::thread(&ProcProcessSource::connector_loop, this);
+  } else {
+    __print(stderr,
+            "Could not subscribe to the proc connector ({}), falling back to "
+            "scanning /proc",
+            util::get_last_error(error));
+    scan_proc(false);
+    thread = std::thread(&ProcProcessSource::scan_loop, this);
+  }
+}
+
+void ProcProcessSource::stop() {
+  if (stopping.exchange(true)) return;
+  if (stopEvent >= 0) {
+    uint64_t one = 1;
+    write(stopEvent, &one, sizeof one);
+  }
+  if (thread.joinable()) thread.join();
+  if (nlSocket >= 0) close(nlSocket);
+  if (stopEvent >= 0) close(stopEvent);
+  nlSocket = stopEvent = -1;
+}
+
+int ProcProcessSource::open_connector() {
+  nlSocket = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (nlSocket < 0) return errno;
+
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = 0;  // let the kernel assign the port id
+  if (bind(nlSocket, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+    auto error = errno;
+    close(nlSocket);
+    nlSocket = -1;
+    return error;
+  }
+
+  alignas(nlmsghdr) char buf[NLMSG_SPACE(sizeof(cn_msg) +
+                                         sizeof(proc_cn_mcast_op))]{};
+  auto nlh = reinterpret_cast<nlmsghdr*>(buf);
+  nlh->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+  nlh->nlmsg_type = NLMSG_DONE;
+  nlh->nlmsg_pid = getpid();
+
+  auto msg = reinterpret_cast<cn_msg*>(NLMSG_DATA(nlh));
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  // echoed in the ack, which goes to every listener
+  msg->seq = static_cast<uint32_t>(getpid());
+  msg->ack = 0;
+  msg->len = sizeof(proc_cn_mcast_op);
+  proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  memcpy(msg->data, &op, sizeof op);
+
+  auto error = 0;
+  if (send(nlSocket, nlh, nlh->nlmsg_len, 0) < 0)
+    error = errno;
+  else
+    error = await_subscription_ack(msg->seq);
+  if (error != 0) {
+    close(nlSocket);
+    nlSocket = -1;
+  }
+  return error;
+}
+
+int ProcProcessSource::await_subscription_ack(uint32_t seq) {
+  // Refusals (EPERM without CAP_NET_ADMIN) come back in a PROC_EVENT_NONE
+  // ack. Outside the initial user or pid namespace, in a container, the
+  // kernel ignores the request without one and no event would ever arrive.
+  alignas(nlmsghdr) char buf[8192];
+  pollfd fd = {.fd = nlSocket, .events = POLLIN};
+  auto deadline = std::chrono::steady_clock::now() + SUBSCRIBE_TIMEOUT;
+
+  while (true) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) return ETIMEDOUT;
+    auto r = ::poll(&fd, 1, static_cast<int>(left.count()));
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) return errno;
+    if (r == 0) return ETIMEDOUT;
+
+    ssize_t len = recv(nlSocket, buf, sizeof buf, 0);
+    if (len < 0 && (errno == EINTR || errno == ENOBUFS)) continue;
+    if (len < 0) return errno;
+
+    for (auto nlh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type != NLMSG_DONE) continue;
+      auto msg = reinterpret_cast<cn_msg*>(NLMSG_DATA(nlh));
+      if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) continue;
+      // events of other processes may come first, they are before our time
+      auto ev = reinterpret_cast<proc_event*>(msg->data);
+      if (ev->what != proc_event::PROC_EVENT_NONE || msg->seq != seq ||
+          msg->ack != 1)
+        continue;
+      return static_cast<int>(ev->event_data.ack.err);
+    }
+  }
+}
+
+void ProcProcessSource::connector_loop() {
+  alignas(nlmsghdr) char buf[8192];
+  pollfd fds[2] = {{.fd = nlSocket, .events = POLLIN},
+                   {.fd = stopEvent, .events = POLLIN}};
+
+  while (!stopping) {
+    // no timeout, we only wake up for events
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      __print(stderr, "poll() on proc connector failed: {}",
+              util::get_last_error());
+      return;
+    }
+    if (fds[1].revents & POLLIN) return;
+    if (!(fds[0].revents & POLLIN)) continue;
+
+    ssize_t len = recv(nlSocket, buf, sizeof buf, 0);
+    if (len < 0) {
+      // ENOBUFS: we were too slow and the kernel dropped events
+      if (errno == ENOBUFS) {
+        DbgLog("Proc connector receive buffer overrun, events were lost");
+        continue;
+      }
+      if (errno == EINTR) continue;
+      __print(stderr, "recv() on proc connector failed: {}",
+              util::get_last_error());
+      return;
+    }
+
+    for (auto nlh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type == NLMSG_NOOP) continue;
+      if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN)
+        break;
+
+      auto msg = reinterpret_cast<cn_msg*>(NLMSG_DATA(nlh));
+      if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) continue;
+
+      auto ev = reinterpret_cast<proc_event*>(msg->data);
+      if (ev->what != proc_event::PROC_EVENT_EXEC) continue;
+      // only the thread group leader replaces the process image
+      if (ev->event_data.exec.process_pid != ev->event_data.exec.process_tgid)
+        continue;
+      // stamped with CLOCK_MONOTONIC, which is what steady_clock reads
+      handle_exec(ev->event_data.exec.process_tgid,
+                  std::chrono::steady_clock::time_point(
+                      std::chrono::nanoseconds(ev->timestamp_ns)));
+    }
+  }
+}
+
+void ProcProcessSource::scan_loop() {
+  pollfd fd = {.fd = stopEvent, .events = POLLIN};
+  while (!stopping) {
+    auto r = ::poll(&fd, 1, SCAN_INTERVAL.count());
+    if (r > 0) return;
+    scan_proc(true);
+  }
+}
+
+void ProcProcessSource::scan_proc(bool report) {
+  std::unordered_set<uint32_t> pids;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator("/proc", ec)) {
+    auto pid = parse_pid(entry.path().filename().string());
+    if (!pid) continue;
+    pids.insert(*pid);
+    if (report && !knownPids.contains(*pid)) handle_exec(*pid);
+  }
+  knownPids = std::move(pids);
+}
+
+void ProcProcessSource::handle_exec(
+    uint32_t pid, std::optional<std::chrono::steady_clock::time_point> execAt) {
+  // the process may already be gone, in which case there is nothing to do
+  auto exe = proc::executable_name(pid);
+  if (!exe) return;
+  // cheap name check first, most execs are not ours
+  if (!gConfig->snapshot()->watches(*exe)) return;
+  if (!proc::is_main_process(pid)) return;
+
+  gService->on_process_created(pid, *exe, execAt);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SERVICE_PROCSOURCE_HPP
+#define SERVICE_PROCSOURCE_HPP
+
+#ifdef __linux__
+
+  #include <atomic>
+  #include <chrono>
+  #include <cstdint>
+  #include <optional>
+  #include <string>
+  #include <thread>
+  #include <unordered_set>
+
+  #include "processsource.hpp"
+
+// Subscribes to PROC_EVENT_EXEC through the kernel netlink proc connector.
+// Subscribing requires CAP_NET_ADMIN; without it we fall back to diffing the
+// pid directories of /proc every SCAN_INTERVAL.
+class ProcProcessSource : public ProcessSource {
+ public:
+  ~ProcProcessSource() override { stop(); }
+
+  void start() override;
+  void stop() override;
+
+ private:
+  int nlSocket = -1;
+  int stopEvent = -1;
+  std::atomic<bool> stopping = false;
+  std::thread thread;
+
+  // pids seen by the last /proc scan
+  std::unordered_set<uint32_t> knownPids;
+
+  // 0 once subscribed, else the errno of the call that failed or the error
+  // the kernel acked the subscription with
+  int open_connector();
+  int await_subscription_ack(uint32_t seq);
+  void connector_loop();
+  void scan_loop();
+  void scan_proc(bool report);
+
+  // execAt is when the kernel saw the exec, unknown to the scanner
+  void handle_exec(
+      uint32_t pid,
+      std::optional<std::chrono::steady_clock::time_point> execAt = {});
+};
+
+namespace proc {
+  // basename of /proc/<pid>/exe
+  std::optional<std::string> executable_name(uint32_t pid);
+  // false for Chromium child processes (any argument starting with --type=)
+  bool is_main_process(uint32_t pid);
+}  // namespace proc
+
+#endif
+
+#endif /* SERVICE_PROCSOURCE_HPP */
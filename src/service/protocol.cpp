@@ -0,0 +1,111 @@
+#include "protocol.hpp"
+
+#include <zlib.h>
+
+namespace {
+  template <typename T>
+  void put(char*& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      *out++ = static_cast<char>(value & 0xFF);
+      value >>= 8;
+    }
+  }
+
+  template <typename T>
+  T get(const char* in) {
+    T value = 0;
+    for (size_t i = sizeof(T); i-- > 0;)
+      value = (value << 8) | static_cast<unsigned char>(in[i]);
+    return value;
+  }
+
+  char* put_header(std::string& frame, MessageType type, uint16_t appId,
+                   uint64_t version, size_t length, uint8_t flags = 0) {
+    frame.resize(FRAME_HEADER_SIZE + length);
+    auto out = frame.data();
+    put<uint8_t>(out, static_cast<uint8_t>(type));
+    put<uint8_t>(out, flags);
+    put<uint16_t>(out, appId);
+    put<uint32_t>(out, static_cast<uint32_t>(length));
+    put<uint64_t>(out, version);
+    return out;
+  }
+}  // namespace
+
+std::string encode_styles_frame(uint16_t appId, uint64_t version,
+                                std::string_view css) {
+  std::string frame;
+  auto out = put_header(frame, MessageType::STYLES_UPDATE, appId, version,
+                        css.size());
+  css.copy(out, css.size());
+  return frame;
+}
+
+std::string encode_delta_frame(uint16_t appId, uint64_t base,
+                               uint64_t version, const StyleDelta& delta) {
+  std::string frame;
+  auto out =
+      put_header(frame, MessageType::STYLES_DELTA, appId, version,
+                 FRAME_DELTA_HEADER_SIZE + delta.insert.size());
+  put<uint64_t>(out, base);
+  put<uint32_t>(out, static_cast<uint32_t>(delta.start));
+  put<uint32_t>(out, static_cast<uint32_t>(delta.deleteCount));
+  delta.insert.copy(out, delta.insert.size());
+  return frame;
+}
+
+std::string encode_shared_frame(uint16_t appId, uint64_t version,
+                                size_t length, std::string_view path) {
+  std::string frame;
+  auto out = put_header(frame, MessageType::STYLES_SHARED, appId, version,
+                        sizeof(uint32_t) + path.size());
+  put<uint32_t>(out, static_cast<uint32_t>(length));
+  path.copy(out, path.size());
+  return frame;
+}
+
+std::string deflate_frame(std::string_view frame) {
+  FrameHeader header;
+  if (!decode_frame_header(frame, header) ||
+      header.flags & FRAME_FLAG_DEFLATED ||
+      header.length < FRAME_DEFLATE_MIN_SIZE)
+    return "";
+  auto payload = frame.substr(FRAME_HEADER_SIZE, header.length);
+
+  z_stream z{};
+  // negative window bits: raw deflate, what zlib.inflateRawSync expects
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return "";
+
+  std::string deflated;
+  auto bound = deflateBound(&z, static_cast<uLong>(payload.size()));
+  auto out = put_header(deflated, header.type, header.appId, header.version,
+                        bound, header.flags | FRAME_FLAG_DEFLATED);
+
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+  z.avail_in = static_cast<uInt>(payload.size());
+  z.next_out = reinterpret_cast<Bytef*>(out);
+  z.avail_out = static_cast<uInt>(bound);
+  auto res = deflate(&z, Z_FINISH);
+  auto length = z.total_out;
+  deflateEnd(&z);
+  if (res != Z_STREAM_END || length >= payload.size()) return "";
+
+  // the header was written for the bound, fix up the length
+  deflated.resize(FRAME_HEADER_SIZE + length);
+  auto lengthAt = deflated.data() + 4;
+  put<uint32_t>(lengthAt, static_cast<uint32_t>(length));
+  return deflated;
+}
+
+bool decode_frame_header(std::string_view frame, FrameHeader& out) {
+  if (frame.size() < FRAME_HEADER_SIZE) return false;
+  auto in = frame.data();
+  out.type = static_cast<MessageType>(get<uint8_t>(in));
+  out.flags = get<uint8_t>(in + 1);
+  out.appId = get<uint16_t>(in + 2);
+  out.length = get<uint32_t>(in + 4);
+  out.version = get<uint64_t>(in + 8);
+  return frame.size() - FRAME_HEADER_SIZE >= out.length;
+}
@@ -0,0 +1,73 @@
+#ifndef SERVICE_PROTOCOL_HPP
+#define SERVICE_PROTOCOL_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+#include "styledelta.hpp"
+
+// Protocol versions a client can ask for in its HELLO ("protocol"). Clients
+// that don't ask get JSON text messages.
+#define PROTOCOL_JSON 1
+// server -> client style messages are binary frames, everything else JSON
+#define PROTOCOL_BINARY 2
+// PROTOCOL_BINARY, but large stylesheets are read from shared memory, see
+// STYLES_SHARED. Servers without the channel enabled answer with
+// PROTOCOL_BINARY.
+#define PROTOCOL_SHARED 3
+
+// Binary frames start with a fixed header, all fields little-endian:
+//   u8  type      MessageType
+//   u8  flags     FRAME_FLAG_*
+//   u16 appId     the server's id for the executable
+//   u32 length    bytes of payload following the header
+//   u64 version   stylesheet version
+// STYLES_UPDATE: the payload is the stylesheet's raw UTF-8.
+// STYLES_DELTA:  u64 base, u32 start, u32 deleteCount, then the inserted
+//                UTF-8.
+// STYLES_SHARED: u32 length, then the UTF-8 path of a file holding the
+//                stylesheet, exactly length bytes of it. Never deflated.
+// If FRAME_FLAG_DEFLATED is set the payload is raw deflate (RFC 1951) of the
+// payload described above and length is its compressed size.
+#define FRAME_HEADER_SIZE 16
+#define FRAME_DELTA_HEADER_SIZE 16
+#define FRAME_FLAG_DEFLATED 0x01
+// smaller payloads aren't worth deflating
+#define FRAME_DEFLATE_MIN_SIZE 1024
+
+enum class MessageType {
+  HELLO = 0,
+  STYLES_UPDATE = 1,
+  STYLES_DELTA = 2,
+  CONNECTED = 3,
+  // client -> server, its stylesheet is out of sync
+  RESYNC = 4,
+  // client -> server, once per process: the first stylesheet is on a page
+  STYLES_APPLIED = 5,
+  // server -> client, PROTOCOL_SHARED: read the stylesheet from a file
+  STYLES_SHARED = 6
+};
+
+typedef struct frame_header_t {
+  MessageType type;
+  uint8_t flags;
+  uint16_t appId;
+  uint32_t length;
+  uint64_t version;
+} FrameHeader;
+
+std::string encode_styles_frame(uint16_t appId, uint64_t version,
+                                std::string_view css);
+std::string encode_delta_frame(uint16_t appId, uint64_t base,
+                               uint64_t version, const StyleDelta& delta);
+std::string encode_shared_frame(uint16_t appId, uint64_t version,
+                                size_t length, std::string_view path);
+// frame with its payload deflated, or empty if the payload is too small or
+// doesn't compress
+std::string deflate_frame(std::string_view frame);
+// false if frame is too short for the header and the length it declares
+bool decode_frame_header(std::string_view frame, FrameHeader& out);
+
+#endif /* SERVICE_PROTOCOL_HPP */
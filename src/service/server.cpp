@@ -1,35 +1,145 @@
+#define LOG_CATEGORY LogCategory::Server
+
 #include "server.hpp"
 
 #include <uwebsockets/App.h>
 
+#ifndef _WIN32
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+
+  #include <cerrno>
+  #include <cstring>
+  #include <filesystem>
+#endif
+
+#include <algorithm>
 #include <nlohmann/json.hpp>
+#include <optional>
 
 #include "../config.hpp"
 #include "../log.hpp"
 #include "../util.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "sharedstyle.hpp"
 
 using json = nlohmann::json;
 
-enum class MessageType { HELLO = 0, STYLES_UPDATE = 1 };
+namespace {
+  using etws = uWS::WebSocket<false, true, PerSocketData>;
 
-void Server::loop() {
-#ifndef _DEBUG
-  srand(static_cast<unsigned int>(time(0)));
-  port = rand() % (65534 - 32768 + 1) + 32768;
-  while (util::check_for_conflicting_ports(port)) {
-    port = rand() % (65534 - 32768 + 1) + 32768;
+  // clients speaking PROTOCOL_BINARY subscribe here instead of to exeName, '/'
+  // can't be part of an executable's name
+  std::string binary_topic(const std::string& exeName) {
+    return "binary/" + exeName;
+  }
+  std::string shared_topic(const std::string& exeName) {
+    return "shared/" + exeName;
+  }
+
+  std::string topic_of(int protocol, const std::string& exeName) {
+    switch (protocol) {
+      case PROTOCOL_SHARED:
+        return shared_topic(exeName);
+      case PROTOCOL_BINARY:
+        return binary_topic(exeName);
+      default:
+        return exeName;
+    }
+  }
+
+  // JSON goes out as text and frames as binary messages, so a client can tell
+  // them apart without knowing what it negotiated yet
+  void send_style(etws* ws, const PreparedStyle& style, bool compress) {
+    switch (ws->getUserData()->protocol) {
+      case PROTOCOL_SHARED:
+        ws->send(style.shared_frame(), uWS::OpCode::BINARY);
+        break;
+      case PROTOCOL_BINARY:
+        ws->send(style.frame(), uWS::OpCode::BINARY);
+        break;
+      default:
+        ws->send(style.message(), uWS::OpCode::TEXT, compress);
+        break;
+    }
+  }
+
+  // clients since the metrics were added send their pid along
+  std::optional<uint32_t> client_pid(const json& payload) {
+    if (!payload.contains("pid") || !payload["pid"].is_number_unsigned())
+      return {};
+    return payload["pid"].get<uint32_t>();
+  }
+
+#ifndef _WIN32
+  // 0 if something accepts connections on path, else why connecting failed
+  int probe_unix_socket(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) return ENAMETOOLONG;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return errno;
+    auto res = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    auto error = res == 0 ? 0 : errno;
+    close(fd);
+    return error;
   }
 #endif
-  using etws = uWS::WebSocket<false, true, PerSocketData>;
-  app = std::make_unique<uWS::App>();
+}  // namespace
+
+Server::Server(ServerOptions options)
+    : options(options), styles(options.sharedStyles) {
+#ifndef _DEBUG
+  // the kernel picks a free one, read back once listening
+  port = 0;
+#endif
+  // objects of a service that crashed stay until the next boot otherwise
+  if (options.sharedStyles) remove_stale_shared_styles();
+
+#ifdef _WIN32
+  // no SO_REUSEPORT, a second listener on the port fails
+  auto count = 1u;
+#else
+  auto count = std::max(options.workers, 1u);
+#endif
+  // all made before any thread starts, the threads only read the vector
+  for (unsigned int i = 0; i < count; ++i)
+    workers.push_back(std::make_unique<Worker>());
+  for (auto& worker : workers)
+    worker->thread = std::thread(&Server::loop, this, std::ref(*worker));
+}
+
+void Server::join() {
+  for (auto& worker : workers)
+    if (worker->thread.joinable()) worker->thread.join();
+}
+
+void Server::loop(Worker& worker) {
+  bool first = &worker == workers.front().get();
+  auto listenPort = port.load();
+  if (!first) {
+    listenPort = portFuture.get();
+    // the first one failed and settled listening() already
+    if (listenPort == 0) return;
+  }
+
+  worker.app = std::make_unique<uWS::App>();
+  worker.loop = uWS::Loop::get();
+  auto app = worker.app.get();
+  bool compress = options.compression != uWS::DISABLED;
 
   app->ws<PerSocketData>(
          "/client",
          {
-             .compression = uWS::SHARED_COMPRESSOR,
+             .compression = options.compression,
              .maxPayloadLength = 16 * 1024 * 1024,
              .idleTimeout = 16,
-             .maxBackpressure = 1 * 1024 * 1024,
+             .maxBackpressure = options.maxBackpressure,
              .closeOnBackpressureLimit = false,
              .resetIdleTimeoutOnSend = false,
              .sendPingsAutomatically = true,
@@ -38,12 +148,12 @@ void Server::loop() {
              .open =
                  [this](etws* ws) {
                    DbgLog("WS connection received");
-                   json p = {{"type", 3}};
-                   ws->send(p.dump());
+                   json p = {{"type", MessageType::CONNECTED}};
+                   ws->send(p.dump(), uWS::OpCode::TEXT);
                  },
              .message =
-                 [this](etws* ws, std::string_view message,
-                        uWS::OpCode opCode) {
+                 [this, compress](etws* ws, std::string_view message,
+                                  uWS::OpCode opCode) {
                    try {
                      auto payload = json::parse(message);
                      if (!payload.contains("type") ||
@@ -63,9 +173,23 @@ void Server::loop() {
                            auto app = gConfig->get_application_by_executable(
                                executableName);
                            DbgLog("WS connected for {}", app);
-                           ws->subscribe(executableName);
-                           auto style = app.get_style();
-                           update_style(app.name, style);
+                           if (auto pid = client_pid(payload))
+                             Metrics::instance().client_hello(*pid);
+
+                           auto asked = PROTOCOL_JSON;
+                           if (payload.contains("protocol") &&
+                               payload["protocol"].is_number_integer())
+                             asked = payload["protocol"].get<int>();
+                           auto protocol = PROTOCOL_JSON;
+                           if (asked >= PROTOCOL_SHARED &&
+                               options.sharedStyles)
+                             protocol = PROTOCOL_SHARED;
+                           else if (asked >= PROTOCOL_BINARY)
+                             protocol = PROTOCOL_BINARY;
+                           ws->getUserData()->protocol = protocol;
+
+                           ws->subscribe(topic_of(protocol, executableName));
+                           send_style(ws, *styles.get(app.name), compress);
                            DbgLog("WS for {} had style sent", app);
                          } catch (const std::exception& ex) {
                            __print(stderr,
@@ -74,6 +198,23 @@ void Server::loop() {
                                    ex.what());
                          }
                        } break;
+                       case MessageType::RESYNC: {
+                         if (!payload.contains("exe") ||
+                             !payload["exe"].is_string())
+                           return;
+                         auto executableName =
+                             payload["exe"].get<std::string>();
+                         if (!gConfig->snapshot()->watches(executableName))
+                           return;
+                         DbgLog("WS for {} asked for a resync",
+                                executableName);
+                         send_style(ws, *styles.get(executableName),
+                                    compress);
+                       } break;
+                       case MessageType::STYLES_APPLIED: {
+                         if (auto pid = client_pid(payload))
+                           Metrics::instance().styles_applied(*pid);
+                       } break;
                        default:
                          break;
                      }
@@ -86,23 +227,135 @@ void Server::loop() {
              .ping = nullptr,
              .pong = nullptr,
          })
-      .listen(port, [](auto* listen_s) {
-        if (listen_s) {
-          DbgLog("Websocket listening");
-        }
-      });
+      // Prometheus scrapes, same port as the clients
+      .get("/metrics",
+           [](auto* res, auto* req) {
+             res->writeHeader("Content-Type",
+                              "text/plain; version=0.0.4; charset=utf-8")
+                 ->end(Metrics::instance().render());
+           });
+
+#ifndef _WIN32
+  // before the port, socketPath is set by the time listening() is. Unix
+  // sockets can't be shared, its clients all go to the first loop.
+  if (first && !options.unixSocket.empty()) listen_unix(*app);
+#endif
+  app->listen(listenPort, [this, &worker](auto* listen_s) {
+    on_listen(worker, listen_s);
+  });
 
   app->run();
+
+  // the loop is this thread's, nobody else can free it
+  {
+    // update_style only defers to loops that are set
+    std::lock_guard<std::mutex> lock(updateMutex);
+    worker.loop = nullptr;
+  }
+  worker.app.reset();
+  uWS::Loop::get()->free();
+}
+
+void Server::on_listen(Worker& worker, us_listen_socket_t* listen_s) {
+  bool first = &worker == workers.front().get();
+  if (!listen_s) {
+    if (first) portPromise.set_value(0);
+    if (!listeningSettled.exchange(true)) listeningPromise.set_value(false);
+    return;
+  }
+
+  if (first) {
+    port = us_socket_local_port(0, reinterpret_cast<us_socket_t*>(listen_s));
+    portPromise.set_value(port);
+  }
+  DbgLog("Websocket listening on port {} ({} of {})", port.load(),
+         listeningWorkers + 1, workers.size());
+  if (++listeningWorkers == workers.size() && !listeningSettled.exchange(true))
+    listeningPromise.set_value(true);
+}
+
+Server::~Server() {
+#ifndef _WIN32
+  if (!socketPath.empty()) unlink(socketPath.c_str());
+#endif
 }
 
-Server::~Server() { uWS::Loop::get()->free(); }
+#ifndef _WIN32
+void Server::listen_unix(uWS::App& app) {
+  // Bound inside a directory only the user can enter, the socket is never
+  // reachable with the umask's permissions in between bind and chmod
+  auto directory = std::filesystem::path(options.unixSocket).parent_path();
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+  if (!ec)
+    std::filesystem::permissions(directory, std::filesystem::perms::owner_all,
+                                 ec);
+  if (ec) {
+    __print(stderr, "Can't prepare {}: {}, clients will use the port",
+            directory.string(), ec.message());
+    return;
+  }
+
+  switch (auto error = probe_unix_socket(options.unixSocket)) {
+    case 0:
+      __print(stderr,
+              "Another instance is listening on {}, clients will use the "
+              "port",
+              options.unixSocket);
+      return;
+    case ECONNREFUSED:
+      // left over if the service didn't exit cleanly, bind fails on it
+      unlink(options.unixSocket.c_str());
+      break;
+    case ENOENT:
+      break;
+    default:
+      __print(stderr, "Can't use {}: {}, clients will use the port",
+              options.unixSocket, util::get_last_error(error));
+      return;
+  }
+
+  app.listen(
+      [this](auto* listen_s) {
+        if (!listen_s) {
+          __print(stderr, "Listening on {} failed, clients will use the port",
+                  options.unixSocket);
+          return;
+        }
+        // only the user's own processes
+        chmod(options.unixSocket.c_str(), S_IRUSR | S_IWUSR);
+        socketPath = options.unixSocket;
+        DbgLog("Websocket listening on {}", socketPath);
+      },
+      options.unixSocket);
+}
+#endif
 
 void Server::update_style(std::string& exeName, std::string& styleContent) {
-  DbgLog("Updating style for {} - styles {} length", exeName,
-         styleContent.size());
-  app->publish(
-      exeName,
-      json({{"type", MessageType::STYLES_UPDATE}, {"css", styleContent}})
-          .dump(),
-      uWS::OpCode::BINARY, false);
+  std::lock_guard<std::mutex> lock(updateMutex);
+  auto prepared = styles.update(exeName, styleContent);
+  if (!prepared) return;
+  // built once, every loop sends the same buffers
+  auto update = std::make_shared<const StyleUpdate>(std::move(*prepared));
+
+  // uWS isn't thread safe, each loop publishes to its own sockets. Deferred
+  // calls run in order, so clients get the versions in order.
+  for (auto& worker : workers) {
+    // not running yet, so no clients to send to either
+    auto loop = worker->loop.load();
+    if (loop == nullptr) continue;
+    loop->defer([this, app = worker->app.get(), exeName, update] {
+      if (app->numSubscribers(exeName) > 0)
+        app->publish(exeName, update->json_message(), uWS::OpCode::TEXT,
+                     options.compression != uWS::DISABLED);
+      auto binaryTopic = binary_topic(exeName);
+      if (app->numSubscribers(binaryTopic) > 0)
+        app->publish(binaryTopic, update->binary_frame(), uWS::OpCode::BINARY,
+                     false);
+      auto sharedTopic = shared_topic(exeName);
+      if (app->numSubscribers(sharedTopic) > 0)
+        app->publish(sharedTopic, update->shared_frame(),
+                     uWS::OpCode::BINARY, false);
+    });
+  }
 }
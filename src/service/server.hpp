@@ -3,26 +3,89 @@
 
 #include <uwebsockets/App.h>
 
+#include <stdint.h>
+
+#include <atomic>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-struct PerSocketData {};
+#include "protocol.hpp"
+#include "stylestore.hpp"
+
+struct PerSocketData {
+  // negotiated in HELLO
+  int protocol = PROTOCOL_JSON;
+};
+
+typedef struct server_options_t {
+  // per-message deflate, only for JSON messages: binary style frames are
+  // deflated once by the StyleStore already. JSON clients have always had it.
+  uWS::CompressOptions compression = uWS::SHARED_COMPRESSOR;
+  // bytes queued for a socket beyond which publishes skip it
+  unsigned int maxBackpressure = 1 * 1024 * 1024;
+  // path of a Unix domain socket to listen on besides the TCP port, none if
+  // empty
+  std::string unixSocket;
+  // PROTOCOL_SHARED for the clients that ask for it, not on Windows
+  bool sharedStyles = false;
+  // uWS apps listening on the port, each with its own loop and thread. The
+  // kernel spreads connections over them (SO_REUSEPORT), one on Windows.
+  unsigned int workers = 1;
+} ServerOptions;
 
 class Server {
  public:
-  Server() { thread = std::thread(&Server::loop, this); }
+  Server(ServerOptions options = {});
   ~Server();
   void release();
+  // returns once the loops stop, which they don't before the process exits
+  void join();
 
   void update_style(std::string& exeName, std::string& styleContent);
-  int port = 64132;
-
-  std::thread thread;
+  // fixed in debug builds, else assigned by the kernel when listening.
+  // Read it after listening() is ready.
+  std::atomic<int> port = 64132;
+  // unixSocket if listening on it worked, else empty and clients connect
+  // over TCP. Read it after listening() is ready.
+  std::string socketPath;
+  // true once listening on port, false if that failed
+  std::shared_future<bool> listening() const { return listeningFuture; }
 
  private:
-  std::unique_ptr<uWS::App> app;
-  void loop();
+  // A socket stays with the loop that accepted it, so every loop publishes
+  // to its own subscribers
+  typedef struct worker_t {
+    std::thread thread;
+    // only touched from thread
+    std::unique_ptr<uWS::App> app;
+    // set once it runs
+    std::atomic<uWS::Loop*> loop = nullptr;
+  } Worker;
+
+  const ServerOptions options;
+  std::promise<bool> listeningPromise;
+  std::shared_future<bool> listeningFuture = listeningPromise.get_future();
+  // the first listens on port 0, the others wait for the port it got. 0 if
+  // it failed.
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::promise<int> portPromise;
+  std::shared_future<int> portFuture = portPromise.get_future().share();
+  std::atomic<size_t> listeningWorkers = 0;
+  std::atomic<bool> listeningSettled = false;
+
+  void loop(Worker& worker);
+  void on_listen(Worker& worker, us_listen_socket_t* listen_s);
+#ifndef _WIN32
+  void listen_unix(uWS::App& app);
+#endif
+
+  StyleStore styles;
+  // keeps updates of the same application in version order
+  std::mutex updateMutex;
 };
 
 #endif /* SERVICE_SERVER_HPP */
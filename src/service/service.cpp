@@ -1,93 +1,33 @@
+#define LOG_CATEGORY LogCategory::Loader
+
 #include "service.hpp"
 
 #include <cstdio>
+#include <stdexcept>
 #include <thread>
 
+#include "../config.hpp"
 #include "../log.hpp"
 #include "../util.hpp"
+#include "metrics.hpp"
 
 std::unique_ptr<Service> gService;
 
-void Service::initialize_wmi() {
-  HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-  if (FAILED(hr))
-    throw std::runtime_error("Failed to initialize COM: " + std::to_string(hr));
-  hr = CoInitializeSecurity(
-      nullptr, -1, nullptr, nullptr, RPC_C_AUTHN_LEVEL_DEFAULT,
-      RPC_C_IMP_LEVEL_IMPERSONATE, nullptr, EOAC_NONE, nullptr);
-  if (FAILED(hr)) {
-    CoUninitialize();
-    throw std::runtime_error("Failed to initialize COM security level: " +
-                             std::to_string(hr));
-  }
-
-  hr = CoCreateInstance(CLSID_WbemLocator, nullptr, CLSCTX_INPROC_SERVER,
-                        IID_IWbemLocator, reinterpret_cast<void**>(&pLoc));
-  if (FAILED(hr)) {
-    CoUninitialize();
-    throw std::runtime_error("Failed to create WbemLocator instance: " +
-                             std::to_string(hr));
-  }
-
-  hr = pLoc->ConnectServer(_bstr_t(L"ROOT\\CIMV2"), nullptr, nullptr, 0, 0, 0,
-                           0, &pSvc);
-  if (FAILED(hr)) {
-    destroy_wmi();
-    throw std::runtime_error("Failed to connect to WMI: " + std::to_string(hr));
-  }
-
-  hr = CoSetProxyBlanket(pSvc, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE, nullptr,
-                         RPC_C_AUTHN_LEVEL_CALL, RPC_C_IMP_LEVEL_IMPERSONATE,
-                         nullptr, EOAC_NONE);
-  if (FAILED(hr)) {
-    destroy_wmi();
-    throw std::runtime_error("Failed to set proxy blanket: " +
-                             std::to_string(hr));
-  }
-
-  hr = CoCreateInstance(CLSID_UnsecuredApartment, nullptr, CLSCTX_LOCAL_SERVER,
-                        IID_IUnsecuredApartment,
-                        reinterpret_cast<void**>(&pApp));
-  if (FAILED(hr)) {
-    destroy_wmi();
-    throw std::runtime_error("Failed to create UnsecuredApartment instance: " +
-                             std::to_string(hr));
-  }
-
-  pApp->CreateObjectStub(pSink, &pStubUnk);
-
-  pStubUnk->QueryInterface(IID_IWbemObjectSink,
-                           reinterpret_cast<void**>(&pStubSink));
-
-  // child processes of Electron apps have --type command line argument
-  // we are only targeting the main processes as those are the only processes
-  // that have the debug handler
-  hr = pSvc->ExecNotificationQueryAsync(
-      _bstr_t("WQL"),
-      _bstr_t("SELECT * FROM "
-              "__InstanceCreationEvent WITHIN "
-              "1 WHERE "  // PollingInterval
-                          // = 1.fsec
-              "TargetInstance ISA "
-              "'Win32_Process' AND NOT "
-              "TargetInstance.CommandLine "
-              "LIKE '%--type=%'"),
-      WBEM_FLAG_SEND_STATUS, nullptr, pStubSink);
-  if (FAILED(hr)) {
-    destroy_wmi();
-    throw std::runtime_error("Failed to setup WMI notification: " +
-                             std::to_string(hr));
-  }
-}
-
-void Service::destroy_wmi() {
-  if (pSvc != nullptr) pSvc->Release();
-  if (pLoc != nullptr) pLoc->Release();
-  if (pApp != nullptr) pApp->Release();
-  if (pStubUnk != nullptr) pStubUnk->Release();
-  if (pSink != nullptr) pSink->Release();
-  if (pStubSink != nullptr) pStubSink->Release();
-  CoUninitialize();
+void Service::on_process_created(
+    uint32_t processId, const std::string& executableName,
+    std::optional<std::chrono::steady_clock::time_point> createdAt) {
+  auto config = gConfig->snapshot();
+  auto app = config->by_executable(executableName);
+  // we aren't watching this process
+  if (app == nullptr) return;
+  Metrics::instance().process_seen(processId, createdAt);
+
+  loader->enqueue({.processId = processId,
+                   .executableName = executableName,
+                   .removeCSP = app->removeCSP,
+                   .attach = app->attach,
+                   .injectionMode = app->injectionMode,
+                   .createdAt = createdAt});
 }
 
 void Service::start() {
@@ -106,21 +46,41 @@ void Service::start() {
   }
 
   __print(stdout, "Starting WebSocket server");
-  server = std::make_unique<Server>();
+  ServerOptions serverOptions;
+#ifndef _WIN32
+  if (gConfig->unixSocket)
+    serverOptions.unixSocket =
+        (gConfig->config_directory / SOCKET_DIRECTORY / SOCKET_FILE).string();
+  serverOptions.sharedStyles = gConfig->sharedStyles;
+  serverOptions.workers = gConfig->serverWorkers;
+#endif
+  server = std::make_unique<Server>(serverOptions);
+  // the loader hands the port to every client
+  if (!server->listening().get()) {
+    __print(stderr, "Starting WebSocket server failed");
+    exit(1);
+  }
+  // read and bundled here rather than on a server loop when each
+  // application's first client asks
+  for (const auto& app : gConfig->snapshot()->applications) {
+    auto name = app.name;
+    auto style = app.get_style();
+    server->update_style(name, style);
+  }
 
-  __print(stdout, "Starting loader thread");
-  loader = std::make_unique<Loader>();
+  __print(stdout, "Starting {} loader threads", gConfig->loaderWorkers);
+  loader = std::make_unique<Loader>(gConfig->loaderWorkers);
 
   __print(stdout, "Initializing process watcher");
   try {
-    pSink = new EventSink();
-    initialize_wmi();
+    processSource = make_process_source();
+    processSource->start();
   } catch (const std::exception& ex) {
     __print(stderr, "Initializing process watcher failed: {}", ex.what());
     exit(1);
   }
 
-  server->thread.join();
+  server->join();
 
-  destroy_wmi();
+  processSource->stop();
 }
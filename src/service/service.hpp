@@ -1,12 +1,15 @@
 #ifndef SERVICE_SERVICE_HPP
 #define SERVICE_SERVICE_HPP
 
-#include <Windows.h>
-
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
 #include <thread>
 
-#include "eventsink.hpp"
 #include "loader.hpp"
+#include "processsource.hpp"
 #include "server.hpp"
 
 class Service {
@@ -15,16 +18,14 @@ class Service {
   std::unique_ptr<Server> server;
   void start();
 
- private:
-  IWbemLocator* pLoc = nullptr;
-  IWbemServices* pSvc = nullptr;
-  IUnsecuredApartment* pApp = nullptr;
-  EventSink* pSink = nullptr;
-  IUnknown* pStubUnk = nullptr;
-  IWbemObjectSink* pStubSink = nullptr;
+  // called by the ProcessSource for every new main process, createdAt is
+  // when it started if the source knows
+  void on_process_created(
+      uint32_t processId, const std::string& executableName,
+      std::optional<std::chrono::steady_clock::time_point> createdAt = {});
 
-  void initialize_wmi();
-  void destroy_wmi();
+ private:
+  std::unique_ptr<ProcessSource> processSource;
 };
 
 extern std::unique_ptr<Service> gService;
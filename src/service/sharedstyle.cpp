@@ -0,0 +1,89 @@
+#define LOG_CATEGORY LogCategory::Server
+
+#include "sharedstyle.hpp"
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+
+  #include <cerrno>
+  #include <cstdlib>
+  #include <filesystem>
+#endif
+
+#include <format>
+#include <stdexcept>
+
+#include "../log.hpp"
+#include "../util.hpp"
+
+#ifndef _WIN32
+SharedStyle::SharedStyle(uint16_t appId, uint64_t version,
+                         std::string_view css)
+    : name(std::format("/" SHARED_STYLE_PREFIX "{}-{}-{}", getpid(), appId,
+                       version)),
+      path(SHARED_STYLE_DIRECTORY + name) {
+  // only the user's own processes
+  auto open = [this] {
+    return shm_open(name.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR);
+  };
+  auto fd = open();
+  if (fd < 0 && errno == EEXIST) {
+    // left by an earlier process that had our pid, nothing maps it anymore
+    DbgLog("Replacing stale shared style {}", name);
+    shm_unlink(name.c_str());
+    fd = open();
+  }
+  if (fd < 0)
+    throw std::runtime_error("shm_open(" + name +
+                             ") failed: " + util::get_last_error());
+
+  // written like a file, tmpfs keeps it in memory
+  size_t written = 0;
+  while (written < css.size()) {
+    auto n = write(fd, css.data() + written, css.size() - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      auto error = util::get_last_error();
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("Writing " + name + " failed: " + error);
+    }
+    written += static_cast<size_t>(n);
+  }
+  close(fd);
+  DbgLog("Shared version {} of app {} in {}", version, appId, path);
+}
+
+SharedStyle::~SharedStyle() { shm_unlink(name.c_str()); }
+
+void remove_stale_shared_styles() {
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(SHARED_STYLE_DIRECTORY, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    auto file = it->path().filename().string();
+    if (!file.starts_with(SHARED_STYLE_PREFIX)) continue;
+    auto pid = atoi(file.c_str() + sizeof(SHARED_STYLE_PREFIX) - 1);
+    // ours can only be from an earlier process with the same pid, this runs
+    // before the first SharedStyle is made
+    if (pid <= 0 ||
+        (pid != getpid() && (kill(pid, 0) == 0 || errno != ESRCH)))
+      continue;
+    DbgLog("Removing stale shared style {}", file);
+    shm_unlink(("/" + file).c_str());
+  }
+}
+#else
+SharedStyle::SharedStyle(uint16_t appId, uint64_t version,
+                         std::string_view css) {
+  throw std::runtime_error("Shared styles aren't supported on Windows");
+}
+
+SharedStyle::~SharedStyle() {}
+
+void remove_stale_shared_styles() {}
+#endif
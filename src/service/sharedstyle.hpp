@@ -0,0 +1,40 @@
+#ifndef SERVICE_SHAREDSTYLE_HPP
+#define SERVICE_SHAREDSTYLE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+// shm_open() names, followed by the service's pid
+#define SHARED_STYLE_PREFIX "electrotheme-"
+// where shm_open() objects show up as files on Linux, clients read them there
+#define SHARED_STYLE_DIRECTORY "/dev/shm"
+// smaller stylesheets go over the socket, the frame is about as cheap as the
+// notification
+#define SHARED_STYLE_MIN_SIZE (256 * 1024)
+
+// One stylesheet version in a POSIX shared memory object, for PROTOCOL_SHARED
+// clients to read instead of receiving it over the socket. Written once
+// however many clients read it, and never modified: the next version gets
+// its own. Unlinked when destroyed, a client that reads too late doesn't find
+// it and asks for a resync.
+class SharedStyle {
+ public:
+  // throws if the object can't be created, or on Windows
+  SharedStyle(uint16_t appId, uint64_t version, std::string_view css);
+  ~SharedStyle();
+  SharedStyle(const SharedStyle&) = delete;
+  SharedStyle& operator=(const SharedStyle&) = delete;
+
+  // for shm_open()
+  const std::string name;
+  // the file clients read
+  const std::string path;
+};
+
+// Unlinks the objects of services that exited without doing so themselves,
+// including any carrying our pid. Call it before making a SharedStyle.
+void remove_stale_shared_styles();
+
+#endif /* SERVICE_SHAREDSTYLE_HPP */
@@ -0,0 +1,48 @@
+#include "styledelta.hpp"
+
+#include <algorithm>
+
+namespace {
+  bool is_continuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+  }
+}  // namespace
+
+size_t utf16_length(std::string_view utf8) {
+  size_t units = 0;
+  for (char c : utf8) {
+    auto b = static_cast<unsigned char>(c);
+    if (is_continuation(c)) continue;
+    // four byte sequences are surrogate pairs in UTF-16
+    units += b >= 0xF0 ? 2 : 1;
+  }
+  return units;
+}
+
+StyleDelta compute_style_delta(std::string_view from, std::string_view to) {
+  auto shorter = std::min(from.size(), to.size());
+
+  size_t prefix = std::mismatch(from.begin(), from.begin() + shorter,
+                                to.begin())
+                      .first -
+                  from.begin();
+  // don't split a character, the offsets are in characters
+  while (prefix > 0 &&
+         ((prefix < from.size() && is_continuation(from[prefix])) ||
+          (prefix < to.size() && is_continuation(to[prefix]))))
+    --prefix;
+
+  // the suffix must not overlap the prefix in either string
+  size_t maxSuffix = shorter - prefix;
+  size_t suffix = std::mismatch(from.rbegin(), from.rbegin() + maxSuffix,
+                                to.rbegin())
+                      .first -
+                  from.rbegin();
+  while (suffix > 0 && is_continuation(from[from.size() - suffix])) --suffix;
+
+  auto removed = from.substr(prefix, from.size() - prefix - suffix);
+  auto inserted = to.substr(prefix, to.size() - prefix - suffix);
+  return {.start = utf16_length(from.substr(0, prefix)),
+          .deleteCount = utf16_length(removed),
+          .insert = std::string(inserted)};
+}
@@ -0,0 +1,26 @@
+#ifndef SERVICE_STYLEDELTA_HPP
+#define SERVICE_STYLEDELTA_HPP
+
+#include <stddef.h>
+
+#include <string>
+#include <string_view>
+
+// One splice turning an old stylesheet into a new one: deleteCount characters
+// at start are replaced by insert. Offsets count UTF-16 code units, which is
+// what String.prototype.slice works in on the client.
+typedef struct style_delta_t {
+  size_t start;
+  size_t deleteCount;
+  std::string insert;
+} StyleDelta;
+
+// Everything between the common prefix and suffix of from and to is the
+// edit, so a single change in a large theme yields a delta the size of that
+// change. Both must be valid UTF-8.
+StyleDelta compute_style_delta(std::string_view from, std::string_view to);
+
+// number of UTF-16 code units in utf8
+size_t utf16_length(std::string_view utf8);
+
+#endif /* SERVICE_STYLEDELTA_HPP */
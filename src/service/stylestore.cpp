@@ -0,0 +1,140 @@
+#define LOG_CATEGORY LogCategory::Server
+
+#include "stylestore.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include "../config.hpp"
+#include "../log.hpp"
+#include "../util.hpp"
+#include "protocol.hpp"
+#include "styledelta.hpp"
+
+using json = nlohmann::json;
+
+PreparedStyle::PreparedStyle(uint16_t appId, uint64_t version, std::string css,
+                             bool shared)
+    : appId(appId),
+      version(version),
+      css(std::move(css)),
+      hash(util::hash(this->css)) {
+  if (!shared || this->css.size() < SHARED_STYLE_MIN_SIZE) return;
+  try {
+    shared_ = std::make_unique<SharedStyle>(appId, version, this->css);
+    sharedFrame_ =
+        encode_shared_frame(appId, version, this->css.size(), shared_->path);
+  } catch (const std::exception& ex) {
+    __print(stderr, "Sending version {} over the socket instead: {}", version,
+            ex.what());
+  }
+}
+
+const std::string& PreparedStyle::frame() const {
+  std::call_once(frameOnce, [this] {
+    frame_ = encode_styles_frame(appId, version, css);
+    if (auto deflated = deflate_frame(frame_); !deflated.empty())
+      frame_ = std::move(deflated);
+  });
+  return frame_;
+}
+
+const std::string& PreparedStyle::message() const {
+  std::call_once(messageOnce, [this] {
+    message_ = json({{"type", MessageType::STYLES_UPDATE},
+                     {"version", version},
+                     {"css", css}})
+                   .dump();
+  });
+  return message_;
+}
+
+const std::string& PreparedStyle::shared_frame() const {
+  return shared_ ? sharedFrame_ : frame();
+}
+
+std::shared_ptr<const PreparedStyle> StyleStore::get(
+    const std::string& exeName) {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    if (auto it = styles.find(exeName); it != styles.end()) return it->second;
+  }
+
+  // read and bundled outside the lock, clients of other applications
+  // shouldn't wait for the disk. Throws if there is no such application.
+  auto css = gConfig->get_application_by_executable(exeName).get_style();
+
+  std::lock_guard<std::mutex> lock(m);
+  // the watcher or another client got in first
+  auto& style = styles[exeName];
+  if (style == nullptr)
+    style = std::make_shared<const PreparedStyle>(nextAppId++, 1,
+                                                  std::move(css), sharedStyles);
+  return style;
+}
+
+std::optional<StyleUpdate> StyleStore::update(const std::string& exeName,
+                                              std::string css) {
+  auto hash = util::hash(css);
+  while (true) {
+    std::shared_ptr<const PreparedStyle> previous;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      auto it = styles.find(exeName);
+      if (it == styles.end()) {
+        // nobody asked for it yet, there is nothing to diff against. Built
+        // under the lock like get() does, so the id is only taken once the
+        // application is sure to be new.
+        StyleUpdate update;
+        update.style = std::make_shared<const PreparedStyle>(nextAppId, 1, css,
+                                                             sharedStyles);
+        styles.emplace(exeName, update.style);
+        ++nextAppId;
+        DbgLog("Added style for {} - styles {} length", exeName,
+               update.style->css.size());
+        return update;
+      }
+      previous = it->second;
+    }
+
+    if (previous->hash == hash && previous->css == css) {
+      DbgLog("Style for {} is unchanged", exeName);
+      return std::nullopt;
+    }
+
+    // deflating and diffing happen outside the lock, HELLOs for other
+    // applications shouldn't wait for them
+    StyleUpdate update;
+    update.style = std::make_shared<const PreparedStyle>(
+        previous->appId, previous->version + 1, css, sharedStyles);
+    const auto& current = *update.style;
+
+    // clients that have the previous version only need the edit
+    auto delta = compute_style_delta(previous->css, current.css);
+    if (delta.insert.size() < current.css.size() / 2) {
+      update.message = json({{"type", MessageType::STYLES_DELTA},
+                             {"base", previous->version},
+                             {"version", current.version},
+                             {"start", delta.start},
+                             {"deleteCount", delta.deleteCount},
+                             {"insert", delta.insert}})
+                           .dump();
+      update.frame = encode_delta_frame(current.appId, previous->version,
+                                        current.version, delta);
+      if (auto deflated = deflate_frame(update.frame); !deflated.empty())
+        update.frame = std::move(deflated);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+      auto& slot = styles[exeName];
+      // another update got in first, start over from there
+      if (slot != previous) continue;
+      slot = update.style;
+    }
+
+    DbgLog("Updated style for {} to version {} - styles {} length, sending {}",
+           exeName, current.version, current.css.size(),
+           update.message.empty() ? "all of it" : "a delta");
+    return update;
+  }
+}
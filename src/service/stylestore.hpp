@@ -0,0 +1,93 @@
+#ifndef SERVICE_STYLESTORE_HPP
+#define SERVICE_STYLESTORE_HPP
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "sharedstyle.hpp"
+
+// One version of an application's stylesheet with the messages announcing
+// it, built once and shared by every socket it's sent to. version goes up with
+// every change, a client can only apply a delta made against the version it
+// has.
+class PreparedStyle {
+ public:
+  // With shared, css is copied to shared memory right away if it is large
+  // enough, so the loops only send the notification
+  PreparedStyle(uint16_t appId, uint64_t version, std::string css,
+                bool shared = false);
+
+  // identifies the executable in binary frames
+  const uint16_t appId;
+  const uint64_t version;
+  const std::string css;
+  const uint64_t hash;
+
+  // STYLES_UPDATE as a binary frame, deflated if that made it smaller. Built
+  // on first use, clients reading shared memory never need it.
+  const std::string& frame() const;
+  // STYLES_UPDATE as JSON, built on first use since only older clients speak
+  // it
+  const std::string& message() const;
+  // STYLES_SHARED for the copy of css in shared memory, frame() if there is
+  // none
+  const std::string& shared_frame() const;
+
+ private:
+  mutable std::once_flag frameOnce;
+  mutable std::string frame_;
+  mutable std::once_flag messageOnce;
+  mutable std::string message_;
+  std::unique_ptr<SharedStyle> shared_;
+  std::string sharedFrame_;
+};
+
+// What the subscribers of an application are sent when its stylesheet
+// changes: the edit since the previous version, or the whole stylesheet if
+// the edit is about as large.
+typedef struct style_update_t {
+  std::shared_ptr<const PreparedStyle> style;
+  // empty when it's the whole stylesheet, use style->message() and
+  // style->frame()
+  std::string message;
+  std::string frame;
+
+  const std::string& json_message() const {
+    return message.empty() ? style->message() : message;
+  }
+  const std::string& binary_frame() const {
+    return message.empty() ? style->frame() : frame;
+  }
+  // deltas are small enough for the socket
+  const std::string& shared_frame() const {
+    return message.empty() ? style->shared_frame() : frame;
+  }
+} StyleUpdate;
+
+// The current stylesheet of each application. The service prepares them at
+// startup and the watcher replaces them as they change. A client asking
+// for one that isn't there yet has it read then.
+class StyleStore {
+ public:
+  // sharedStyles: PreparedStyles are made with shared
+  StyleStore(bool sharedStyles = false) : sharedStyles(sharedStyles) {}
+
+  // throws if there is no application for exeName
+  std::shared_ptr<const PreparedStyle> get(const std::string& exeName);
+  // nothing if css is what the application already has
+  std::optional<StyleUpdate> update(const std::string& exeName,
+                                    std::string css);
+
+ private:
+  const bool sharedStyles;
+  std::mutex m;
+  std::unordered_map<std::string, std::shared_ptr<const PreparedStyle>> styles;
+  uint16_t nextAppId = 0;
+};
+
+#endif /* SERVICE_STYLESTORE_HPP */
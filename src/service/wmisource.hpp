@@ -0,0 +1,30 @@
+#ifndef SERVICE_WMISOURCE_HPP
+#define SERVICE_WMISOURCE_HPP
+
+#ifdef _WIN32
+
+  #include "eventsink.hpp"
+  #include "processsource.hpp"
+
+// Receives __InstanceCreationEvent notifications for Win32_Process through
+// EventSink
+class WmiProcessSource : public ProcessSource {
+ public:
+  void start() override;
+  void stop() override;
+
+ private:
+  IWbemLocator* pLoc = nullptr;
+  IWbemServices* pSvc = nullptr;
+  IUnsecuredApartment* pApp = nullptr;
+  EventSink* pSink = nullptr;
+  IUnknown* pStubUnk = nullptr;
+  IWbemObjectSink* pStubSink = nullptr;
+
+  void initialize_wmi();
+  void destroy_wmi();
+};
+
+#endif
+
+#endif /* SERVICE_WMISOURCE_HPP */
@@ -0,0 +1,284 @@
+#define LOG_CATEGORY LogCategory::Watcher
+
+#include "stylebundler.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+
+#include "log.hpp"
+
+std::unique_ptr<StyleBundler> gBundler;
+
+namespace {
+  bool starts_with_nocase(std::string_view s, size_t at, std::string_view w) {
+    if (s.size() - at < w.size()) return false;
+    for (size_t i = 0; i < w.size(); ++i)
+      if (tolower(static_cast<unsigned char>(s[at + i])) != w[i]) return false;
+    return true;
+  }
+
+  // index after the comment or string starting at i, i if there is none
+  size_t skip_comment_or_string(std::string_view css, size_t i) {
+    if (css.substr(i, 2) == "/*") {
+      auto end = css.find("*/", i + 2);
+      return end == std::string_view::npos ? css.size() : end + 2;
+    }
+    if (css[i] == '"' || css[i] == '\'') {
+      for (auto j = i + 1; j < css.size(); ++j) {
+        if (css[j] == '\\') {
+          ++j;
+        } else if (css[j] == css[i] || css[j] == '\n') {
+          return j + 1;
+        }
+      }
+      return css.size();
+    }
+    return i;
+  }
+
+  std::string_view trim(std::string_view s) {
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.front())))
+      s.remove_prefix(1);
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.back())))
+      s.remove_suffix(1);
+    return s;
+  }
+
+  std::string_view unquote(std::string_view s) {
+    s = trim(s);
+    if (s.size() >= 2 && (s.front() == '"' || s.front() == '\'') &&
+        s.back() == s.front())
+      s = s.substr(1, s.size() - 2);
+    return s;
+  }
+
+  // url and conditions of the statement between "@import" and ';'
+  bool parse_import(std::string_view statement, std::string& url,
+                    std::string& conditions) {
+    statement = trim(statement);
+    size_t end;
+    if (!statement.empty() &&
+        (statement.front() == '"' || statement.front() == '\'')) {
+      end = skip_comment_or_string(statement, 0);
+      url = unquote(statement.substr(0, end));
+    } else if (starts_with_nocase(statement, 0, "url(")) {
+      end = statement.find(')');
+      if (end == std::string_view::npos) return false;
+      url = unquote(statement.substr(4, end - 4));
+      ++end;
+    } else {
+      return false;
+    }
+    conditions = trim(statement.substr(end));
+    return true;
+  }
+
+  bool is_local(const std::string& url) {
+    return !url.empty() && url.front() != '/' && url.front() != '\\' &&
+           url.find(':') == std::string::npos;
+  }
+
+  // The blocks an imported sheet has to be wrapped in to keep its
+  // conditions: "layer(name)" / "layer", "supports(...)", then media. False
+  // if layer() or supports() isn't closed, nothing is opened then.
+  bool open_conditions(std::string_view conditions, std::string& out,
+                       int& opened) {
+    std::string blocks;
+    int count = 0;
+    conditions = trim(conditions);
+    if (starts_with_nocase(conditions, 0, "layer")) {
+      auto rest = conditions.substr(5);
+      if (!rest.empty() && rest.front() == '(') {
+        auto close = rest.find(')');
+        if (close == std::string_view::npos) return false;
+        blocks += "@layer " + std::string(rest.substr(1, close - 1)) + " {\n";
+        conditions = rest.substr(close + 1);
+      } else {
+        blocks += "@layer {\n";
+        conditions = rest;
+      }
+      ++count;
+      conditions = trim(conditions);
+    }
+    if (starts_with_nocase(conditions, 0, "supports(")) {
+      // supports() may nest parentheses
+      int depth = 0;
+      auto close = std::string_view::npos;
+      for (size_t i = 8; i < conditions.size(); ++i) {
+        if (conditions[i] == '(') ++depth;
+        if (conditions[i] == ')' && --depth == 0) {
+          close = i;
+          break;
+        }
+      }
+      if (close == std::string_view::npos) return false;
+      blocks += "@supports " + std::string(conditions.substr(8, close - 7)) +
+                " {\n";
+      ++count;
+      conditions = trim(conditions.substr(close + 1));
+    }
+    if (!conditions.empty()) {
+      blocks += "@media " + std::string(conditions) + " {\n";
+      ++count;
+    }
+    out += blocks;
+    opened += count;
+    return true;
+  }
+}  // namespace
+
+std::string StyleBundler::bundle(const Application& app) {
+  auto root = (gConfig->styles_directory / app.directory / app.style)
+                  .lexically_normal();
+
+  std::lock_guard<std::mutex> lock(m);
+  Output out;
+  std::vector<std::filesystem::path> stack;
+  std::set<std::filesystem::path> included;
+  // a missing file is still a dependency, creating it rebuilds the bundle
+  included.insert(root);
+  if (auto file = load(root)) append(root, *file, out, stack, included);
+
+  // replace the application's edges in the graph
+  remove_edges(app.directory);
+  for (const auto& file : included) includedBy[file].insert(app.directory);
+  includes[app.directory] = std::move(included);
+
+  // @imports have to precede every other rule, the ones left go first
+  return out.charset + out.imports + out.body;
+}
+
+std::set<std::string> StyleBundler::dependents(
+    const std::filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(m);
+  auto it = includedBy.find(path.lexically_normal());
+  return it == includedBy.end() ? std::set<std::string>() : it->second;
+}
+
+void StyleBundler::invalidate(const std::filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(m);
+  files.erase(path.lexically_normal());
+}
+
+void StyleBundler::forget(const std::string& directory) {
+  std::lock_guard<std::mutex> lock(m);
+  remove_edges(directory);
+  includes.erase(directory);
+}
+
+void StyleBundler::remove_edges(const std::string& directory) {
+  auto included = includes.find(directory);
+  if (included == includes.end()) return;
+  for (const auto& file : included->second) {
+    auto it = includedBy.find(file);
+    if (it == includedBy.end()) continue;
+    it->second.erase(directory);
+    if (it->second.empty()) includedBy.erase(it);
+  }
+}
+
+std::shared_ptr<const StyleBundler::ParsedFile> StyleBundler::load(
+    const std::filesystem::path& path) {
+  auto text = gFileCache->get(path);
+  if (text == nullptr) return nullptr;
+
+  // the file cache hands out the same buffer until the file changes
+  auto cached = files.find(path);
+  if (cached != files.end() && cached->second->text == text)
+    return cached->second;
+
+  auto parsed = std::make_shared<ParsedFile>();
+  parsed->text = text;
+  std::string_view css = *text;
+
+  if (starts_with_nocase(css, 0, "@charset")) {
+    auto end = css.find(';');
+    if (end != std::string_view::npos) parsed->bodyStart = end + 1;
+  }
+
+  // top level @imports, anything in comments, strings or blocks is skipped
+  int depth = 0;
+  for (size_t i = parsed->bodyStart; i < css.size();) {
+    if (auto next = skip_comment_or_string(css, i); next != i) {
+      i = next;
+      continue;
+    }
+    if (css[i] == '{') ++depth;
+    if (css[i] == '}') depth = std::max(depth - 1, 0);
+    if (depth > 0 || !starts_with_nocase(css, i, "@import")) {
+      ++i;
+      continue;
+    }
+
+    // the statement ends at the first ';' outside of strings
+    auto end = i + 7;
+    while (end < css.size() && css[end] != ';') {
+      auto next = skip_comment_or_string(css, end);
+      end = next != end ? next : end + 1;
+    }
+    CssImport import{.begin = i, .end = std::min(end + 1, css.size())};
+    if (parse_import(css.substr(i + 7, end - i - 7), import.url,
+                     import.conditions))
+      parsed->imports.push_back(std::move(import));
+    i = end + 1;
+  }
+
+  DbgLog("Parsed {} ({} bytes, {} imports)", path.string(), css.size(),
+         parsed->imports.size());
+  files.insert_or_assign(path, parsed);
+  return parsed;
+}
+
+void StyleBundler::append(const std::filesystem::path& path,
+                          const ParsedFile& file, Output& out,
+                          std::vector<std::filesystem::path>& stack,
+                          std::set<std::filesystem::path>& included) {
+  std::string_view text = *file.text;
+
+  // only the stylesheet's own @charset counts
+  if (stack.empty() && file.bodyStart > 0)
+    out.charset = std::string(text.substr(0, file.bodyStart)) + "\n";
+
+  stack.push_back(path);
+  size_t at = file.bodyStart;
+  for (const auto& import : file.imports) {
+    out.body.append(text.substr(at, import.begin - at));
+    at = import.end;
+    auto statement = text.substr(import.begin, import.end - import.begin);
+
+    auto target =
+        (path.parent_path() / std::filesystem::u8path(import.url))
+            .lexically_normal();
+    auto relative = target.lexically_relative(gConfig->styles_directory);
+    bool inside = !relative.empty() && *relative.begin() != "..";
+    if (!is_local(import.url) || !inside) {
+      out.imports.append(statement).append("\n");
+      continue;
+    }
+    if (std::find(stack.begin(), stack.end(), target) != stack.end()) {
+      __print(stderr, "Ignoring circular @import of {} in {}",
+              target.string(), path.string());
+      continue;
+    }
+    included.insert(target);
+    auto imported = load(target);
+    if (imported == nullptr) {
+      out.imports.append(statement).append("\n");
+      continue;
+    }
+
+    out.body += "/* " + import.url + " */\n";
+    int opened = 0;
+    if (!open_conditions(import.conditions, out.body, opened))
+      __print(stderr,
+              "Unclosed parenthesis in the conditions of @import \"{}\" in "
+              "{}, importing it without them",
+              import.url, path.string());
+    append(target, *imported, out, stack, included);
+    for (; opened > 0; --opened) out.body += "\n}";
+    out.body += "\n";
+  }
+  out.body.append(text.substr(at));
+  stack.pop_back();
+}
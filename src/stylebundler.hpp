@@ -0,0 +1,76 @@
+#ifndef STYLEBUNDLER_HPP
+#define STYLEBUNDLER_HPP
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "filecache.hpp"
+
+// Inlines the local @imports of an application's stylesheet, so the target
+// gets one sheet and needs no CSP exception for them. Imports are resolved
+// relative to the importing file and must stay inside the styles directory;
+// remote and missing ones are kept, moved to the top of the sheet.
+//
+// Files are read through gFileCache and parsed once per version of their
+// contents, and which applications include which files is kept as
+// a reverse dependency graph, so a changed partial only rebuilds the sheets
+// that include it and only that partial is read again.
+class StyleBundler {
+ public:
+  std::string bundle(const Application& app);
+
+  // directories of the applications whose last bundle included path
+  std::set<std::string> dependents(const std::filesystem::path& path);
+  // forget what was read from path
+  void invalidate(const std::filesystem::path& path);
+  // drop the application's edges from the graph, once it is removed or moved
+  void forget(const std::string& directory);
+
+ private:
+  typedef struct css_import_t {
+    // the whole statement, including the ';'
+    size_t begin;
+    size_t end;
+    std::string url;
+    // layer / supports() / media query following the url
+    std::string conditions;
+  } CssImport;
+
+  typedef struct parsed_file_t {
+    FileContents text;
+    // end of a leading @charset, which is dropped when the file is imported
+    size_t bodyStart = 0;
+    std::vector<CssImport> imports;
+  } ParsedFile;
+
+  typedef struct output_t {
+    std::string charset;
+    // the @imports that weren't inlined
+    std::string imports;
+    std::string body;
+  } Output;
+
+  std::mutex m;
+  std::map<std::filesystem::path, std::shared_ptr<const ParsedFile>> files;
+  // application directory -> files its bundle includes, and the reverse
+  std::map<std::string, std::set<std::filesystem::path>> includes;
+  std::map<std::filesystem::path, std::set<std::string>> includedBy;
+
+  void remove_edges(const std::string& directory);
+  // null if path can't be read
+  std::shared_ptr<const ParsedFile> load(const std::filesystem::path& path);
+  void append(const std::filesystem::path& path, const ParsedFile& file,
+              Output& out,
+              std::vector<std::filesystem::path>& stack,
+              std::set<std::filesystem::path>& included);
+};
+
+extern std::unique_ptr<StyleBundler> gBundler;
+
+#endif /* STYLEBUNDLER_HPP */
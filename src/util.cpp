@@ -1,104 +1,174 @@
 #include "util.hpp"
 
-#include <WinSock2.h>
-#include <Windows.h>
-#include <iphlpapi.h>
+#ifdef _WIN32
+  #include <WinSock2.h>
+  #include <Windows.h>
+  #include <iphlpapi.h>
+#else
+  #include <unistd.h>
+
+  #include <cerrno>
+  #include <cstdio>
+  #include <cstring>
+  #include <filesystem>
+  #include <fstream>
+#endif
 
 #include <stdexcept>
+#include <vector>
 
 #include "log.hpp"
 
-bool util::check_for_conflicting_ports(int port_) {
-  // For some odd reason GetOwnerModuleFromTcpEntry requires Advapi32.dll to be
-  // loaded and it doesn't load it itself. Else it will return
-  // ERROR_MOD_NOT_FOUND (126L = 0x7e)
-  LoadLibraryA("Advapi32.dll");
+#ifdef _WIN32
+namespace {
+  // Slow, only asked for the listeners that conflict
+  std::string owner_module(MIB_TCPROW_OWNER_MODULE& entry) {
+    // For some odd reason GetOwnerModuleFromTcpEntry requires Advapi32.dll
+    // to be loaded and it doesn't load it itself. Else it will return
+    // ERROR_MOD_NOT_FOUND (126L = 0x7e)
+    static auto advapi = LoadLibraryA("Advapi32.dll");
+
+    // enough for most modules, else the call says how much it needs
+    std::vector<char> buf(1024);
+    DWORD size = static_cast<DWORD>(buf.size());
+    auto hr = GetOwnerModuleFromTcpEntry(
+        &entry, TCPIP_OWNER_MODULE_INFO_BASIC, buf.data(), &size);
+    if (hr == ERROR_INSUFFICIENT_BUFFER) {
+      buf.resize(size);
+      hr = GetOwnerModuleFromTcpEntry(&entry, TCPIP_OWNER_MODULE_INFO_BASIC,
+                                      buf.data(), &size);
+    }
 
-  bool bConflicting = false;
-  DWORD hr = 0;
+    auto info = reinterpret_cast<TCPIP_OWNER_MODULE_BASIC_INFO*>(buf.data());
+    if (hr != NO_ERROR || info->pModuleName == nullptr) {
+      DbgLog("Failed to get owner info for port {}: error 0x{:08x}",
+             ntohs(static_cast<u_short>(entry.dwLocalPort)), hr);
+      return "?";
+    }
+    char name[512];
+    size_t converted = 0;
+    wcstombs_s(&converted, name, info->pModuleName, _TRUNCATE);
+    // converted counts the terminator
+    return std::string(name, converted > 0 ? converted - 1 : 0);
+  }
+}  // namespace
 
-  MIB_TCPTABLE_OWNER_MODULE* tcpTable;
+bool util::check_for_conflicting_ports(int port_) {
+  // the table can grow between asking for its size and getting it
+  std::vector<char> buf;
   DWORD size = 0;
-  hr = GetExtendedTcpTable(nullptr, &size, false, AF_INET,
-                           TCP_TABLE_OWNER_MODULE_LISTENER, 0);
-  if (hr != ERROR_INSUFFICIENT_BUFFER)
-    throw std::runtime_error(
-        "check_for_conflicting_ports(): GetExtendedTcpTable() (size) failed "
-        "with " +
-        util::to_hex(hr));
-
-  tcpTable = new MIB_TCPTABLE_OWNER_MODULE[size];
-  hr = GetExtendedTcpTable(tcpTable, &size, false, AF_INET,
-                           TCP_TABLE_OWNER_MODULE_LISTENER, 0);
+  DWORD hr;
+  do {
+    buf.resize(size);
+    hr = GetExtendedTcpTable(buf.empty() ? nullptr : buf.data(), &size, false,
+                             AF_INET, TCP_TABLE_OWNER_MODULE_LISTENER, 0);
+  } while (hr == ERROR_INSUFFICIENT_BUFFER);
   if (hr != NO_ERROR)
     throw std::runtime_error(
         "check_for_conflicting_ports(): GetExtendedTcpTable() failed with " +
         util::to_hex(hr));
 
-  for (auto i = 0; i < tcpTable->dwNumEntries; ++i) {
-    auto entry = tcpTable->table[i];
-    auto localPort = ntohs(entry.dwLocalPort);
-
-    std::string ownerModule = "?";
-
-    TCPIP_OWNER_MODULE_BASIC_INFO* info;
-    DWORD szInfo = 0;
-    hr = GetOwnerModuleFromTcpEntry(&entry, TCPIP_OWNER_MODULE_INFO_BASIC,
-                                    nullptr, &szInfo);
-
-    if (hr != ERROR_INSUFFICIENT_BUFFER) {
-      DbgLog("Failed to get owner info (size) for port {}: error 0x{:08x}",
-             localPort, hr);
-    } else {
-      info = new TCPIP_OWNER_MODULE_BASIC_INFO[szInfo];
-      hr = GetOwnerModuleFromTcpEntry(&entry, TCPIP_OWNER_MODULE_INFO_BASIC,
-                                      info, &szInfo);
-      if (hr == NO_ERROR && info->pModuleName != nullptr) {
-        char buf[512];
-        size_t numOfCharConvert = 0;
-        wcstombs_s(&numOfCharConvert, buf, info->pModuleName, 512);
-        ownerModule = std::string(buf, numOfCharConvert);
-      } else {
-        DbgLog("Failed to get owner info for port {}: error 0x{:08x}",
-               localPort, hr);
-      }
-    }
+  // port_ 0 checks for the inspector's default port
+  auto wanted = port_ == 0 ? 9229 : port_;
+  auto tcpTable = reinterpret_cast<MIB_TCPTABLE_OWNER_MODULE*>(buf.data());
+  bool bConflicting = false;
+  for (DWORD i = 0; i < tcpTable->dwNumEntries; ++i) {
+    auto& entry = tcpTable->table[i];
+    auto localPort = ntohs(static_cast<u_short>(entry.dwLocalPort));
+    if (localPort != wanted) continue;
+
+    __print(stderr, "Found conflicting port {} - owned by process {} (pid: {})",
+            localPort, owner_module(entry), entry.dwOwningPid);
+    bConflicting = true;
+  }
+  return bConflicting;
+}
 
-    // DbgLog("port {} - owned by process {} (pid: {})", localPort,
-    // ownerModule, entry.dwOwningPid);
-    if (port_ == 0) {  // check for conflicting ports
-      switch (localPort) {
-        case 9229:
-          __print(stderr,
-                  "Found conflicting port {} - owned by process {} (pid: {})",
-                  localPort, ownerModule, entry.dwOwningPid);
-          bConflicting = true;
-          break;
-        default:
-          break;
-      }
-    } else {  // check for conflicting SERVER ports (port_ param)
-      if (localPort == port_) {
-        __print(stderr,
-                "Found conflicting port {} - owned by process {} (pid: {})",
-                localPort, ownerModule, entry.dwOwningPid);
-        return true;  // bConflicting = true;
+#else
+namespace {
+  // The process with the socket inode among its fds, or 0. Walks all of
+  // /proc, so only asked for the listeners that conflict. Other users'
+  // processes can't be looked into without privileges.
+  int socket_owner(unsigned long inode) {
+    auto target = "socket:[" + std::to_string(inode) + "]";
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it("/proc", ec), end;
+         !ec && it != end; it.increment(ec)) {
+      auto pid = it->path().filename().string();
+      if (pid.find_first_not_of("0123456789") != std::string::npos) continue;
+
+      std::error_code fdEc;
+      for (std::filesystem::directory_iterator fd(it->path() / "fd", fdEc);
+           !fdEc && fd != end; fd.increment(fdEc)) {
+        char link[64];
+        auto n = readlink(fd->path().c_str(), link, sizeof(link));
+        if (n > 0 && std::string_view(link, n) == target) return std::stoi(pid);
       }
     }
+    return 0;
   }
 
-  delete[] tcpTable;
+  std::string process_name(int pid) {
+    if (pid == 0) return "?";
+    std::ifstream ifs("/proc/" + std::to_string(pid) + "/comm");
+    std::string name;
+    if (!std::getline(ifs, name)) return "?";
+    return name;
+  }
+}  // namespace
 
+bool util::check_for_conflicting_ports(int port_) {
+  // port_ 0 checks for the inspector's default port
+  unsigned int wanted = port_ == 0 ? 9229 : port_;
+  bool bConflicting = false;
+  for (auto table : {"/proc/net/tcp", "/proc/net/tcp6"}) {
+    std::ifstream ifs(table);
+    std::string line;
+    std::getline(ifs, line);  // header
+
+    //   sl  local_address rem_address   st tx_queue rx_queue tr tm->when
+    //   retrnsmt   uid  timeout inode
+    //    0: 0100007F:240D 00000000:0000 0A 00000000:00000000 00:00000000
+    //   00000000  1000        0 123456 ...
+    while (std::getline(ifs, line)) {
+      unsigned int localPort, state;
+      unsigned long inode;
+      if (sscanf(line.c_str(),
+                 " %*u: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%*x %x %*x:%*x %*x:%*x "
+                 "%*x %*u %*u %lu",
+                 &localPort, &state, &inode) != 3)
+        continue;
+      // 0A = TCP_LISTEN
+      if (state != 0x0A || localPort != wanted) continue;
+
+      auto pid = socket_owner(inode);
+      __print(stderr,
+              "Found conflicting port {} - owned by process {} (pid: {})",
+              localPort, process_name(pid), pid);
+      bConflicting = true;
+    }
+  }
   return bConflicting;
 }
+#endif
 
 std::string util::to_hex(int num) {
   char buf[11];
-  sprintf_s(buf, sizeof(buf), "0x%08x", num);
+  snprintf(buf, sizeof(buf), "0x%08x", num);
   std::string str = buf;
   return str;
 }
 
+uint64_t util::hash(std::string_view data) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : data) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+#ifdef _WIN32
 std::string util::get_last_error(int error) {
   char* buf;
   auto size = FormatMessageA(
@@ -111,3 +181,9 @@ std::string util::get_last_error(int error) {
   return "Error " + to_hex(error) + ":\n  " + msg;
 }
 std::string util::get_last_error() { return get_last_error(GetLastError()); }
+#else
+std::string util::get_last_error(int error) {
+  return "Error " + std::to_string(error) + ": " + strerror(error);
+}
+std::string util::get_last_error() { return get_last_error(errno); }
+#endif
@@ -1,11 +1,16 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <stdint.h>
+
 #include <string>
+#include <string_view>
 
 namespace util {
   bool check_for_conflicting_ports(int port_ = 0);
   std::string to_hex(int num);
+  // FNV-1a, stable across builds so it can name files on disk
+  uint64_t hash(std::string_view data);
   std::string get_last_error(int error);
   std::string get_last_error();
 }  // namespace util
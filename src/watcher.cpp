@@ -1,20 +1,67 @@
+#define LOG_CATEGORY LogCategory::Watcher
+
 #include "watcher.hpp"
 
+#ifdef _WIN32
+  #include <Windows.h>
+#endif
+
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <system_error>
 
 #include "log.hpp"
 #include "service/service.hpp"
+#include "stylebundler.hpp"
+#include "util.hpp"
+
+// not a file path
+#define CONFIG_KEY "/config"
 
 std::unique_ptr<Watcher> gWatcher;
 
+namespace {
+  // Windows: an editor still holding the file open for writing makes opening
+  // it without write sharing fail, the closest thing to inotify's
+  // IN_CLOSE_WRITE. Elsewhere the file only has to stop changing.
+  bool write_closed(const std::filesystem::path& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return GetLastError() != ERROR_SHARING_VIOLATION;
+    CloseHandle(file);
+#endif
+    return true;
+  }
+}  // namespace
+
 Watcher::Watcher() {
   watcher = new efsw::FileWatcher();
   watcherId = watcher->addWatch(gConfig->config_directory.string(), this, true);
+  flusher = std::thread(&Watcher::flush_loop, this);
+}
+
+Watcher::~Watcher() {
+  delete watcher;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stopping = true;
+  }
+  c.notify_all();
+  flusher.join();
 }
 
 void Watcher::start() { watcher->watch(); }
 
+WatcherStats Watcher::stats() const {
+  return {.rawEvents = rawEvents,
+          .coalescedEvents = coalescedEvents,
+          .suppressedDuplicates = suppressedDuplicates};
+}
+
 // efsw::FileWatchListener
 void Watcher::handleFileAction(efsw::WatchID watchId, const std::string& dir,
                                const std::string& filename, efsw::Action action,
@@ -34,20 +81,165 @@ void Watcher::handleFileAction(efsw::WatchID watchId, const std::string& dir,
   // ensure that CONFIG_FILE isn't triggering a config reload if it's
   // being modified inside of a style
   if (filename.compare(CONFIG_FILE) == 0 && !bStyles) {
-    if (action != efsw::Actions::Modified) return;
-    DbgLog("Config file {} modified, reloading configuration", filename);
-    gConfig->load_file(true);
+    // editors that save by renaming a temporary file produce Add/Moved
+    if (action == efsw::Actions::Delete) return;
+    ++rawEvents;
+    schedule(CONFIG_KEY);
     return;
   }
 
-  try {
-    if (bStyles) {
-      auto app = gConfig->get_application_by_directory(styleDir);
+  // every file of the application counts, a save through a temporary file
+  // or swap file shows up as events on other names
+  if (bStyles && styleDir != STYLES_DIRECTORY) {
+    ++rawEvents;
+    schedule((p / filename).lexically_normal().string(), styleDir);
+    // a file renamed away is gone for whoever imported it
+    if (action == efsw::Actions::Moved && !oldFilename.empty())
+      schedule((p / oldFilename).lexically_normal().string(), styleDir);
+  }
+}
+
+void Watcher::schedule(const std::string& key, const std::string& styleDir) {
+  auto state = file_state(watched_file(key));
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto& item = pending[key];
+    item.due = std::chrono::steady_clock::now() + gConfig->watchQuietWindow;
+    item.state = state;
+    item.styleDir = styleDir;
+  }
+  c.notify_all();
+}
+
+void Watcher::flush_loop() {
+  std::unique_lock<std::mutex> lock(m);
+  while (!stopping) {
+    if (pending.empty()) {
+      c.wait(lock);
+      continue;
+    }
+
+    auto next = std::min_element(pending.begin(), pending.end(),
+                                 [](const auto& a, const auto& b) {
+                                   return a.second.due < b.second.due;
+                                 });
+    if (std::chrono::steady_clock::now() < next->second.due) {
+      c.wait_until(lock, next->second.due);
+      continue;
+    }
+
+    auto key = next->first;
+    auto item = next->second;
+    pending.erase(next);
+
+    lock.unlock();
+    bool done = false;
+    try {
+      done = flush(key, item);
+    } catch (const std::exception& ex) {
+      DbgLog("Error while processing file action: {}", ex.what());
+      done = true;
+    }
+    lock.lock();
 
-      auto style = app.get_style();
-      gService->server->update_style(app.name, style);
+    // still being written, look again after another quiet window unless a
+    // new event has rescheduled it already
+    if (!done && !pending.contains(key)) {
+      pending[key] = {
+          .due = std::chrono::steady_clock::now() + gConfig->watchQuietWindow,
+          .state = file_state(watched_file(key)),
+          .styleDir = item.styleDir};
     }
-  } catch (std::exception& ex) {
-    DbgLog("Error while processing file action: {}", ex.what());
   }
 }
+
+bool Watcher::flush(const std::string& key, const Pending& item) {
+  auto path = watched_file(key);
+  if (file_state(path) != item.state || !write_closed(path)) return false;
+  ++coalescedEvents;
+
+  if (key == CONFIG_KEY) {
+    DbgLog("Config file {} modified, reloading configuration",
+           path.string());
+    apply(gConfig->load_file(true));
+  } else {
+    // only the sheets including the file are rebuilt, and of those only the
+    // file itself is read again
+    gFileCache->invalidate(path);
+    gBundler->invalidate(path);
+    auto dependents = gBundler->dependents(path);
+    if (dependents.empty()) dependents.insert(item.styleDir);
+    for (const auto& directory : dependents) publish_style(directory);
+  }
+
+  auto s = stats();
+  DbgLog("Watcher: {} raw events, {} coalesced, {} duplicates suppressed",
+         s.rawEvents, s.coalescedEvents, s.suppressedDuplicates);
+  return true;
+}
+
+void Watcher::apply(const ConfigDiff& diff) {
+  DbgLog("Config reloaded: {} added, {} removed, {} changed",
+         diff.added.size(), diff.removed.size(), diff.changed.size());
+  bool serving = gService != nullptr && gService->server != nullptr;
+  bool loading = gService != nullptr && gService->loader != nullptr;
+
+  // connected clients drop the theme of a removed application
+  for (auto app : diff.removed) {
+    gBundler->forget(app.directory);
+    publishedHashes.erase(app.directory);
+    if (loading) gService->loader->forget(app.name);
+    std::string empty;
+    if (serving) gService->server->update_style(app.name, empty);
+  }
+
+  // replaces the empty sheet if the application was removed before
+  for (const auto& app : diff.added) publish_style(app.directory);
+
+  // script, CSP and attach changes apply from the next launch on, only the
+  // stylesheet is republished
+  for (const auto& change : diff.changed) {
+    if (change.fields & APP_DIRECTORY) {
+      gBundler->forget(change.before.directory);
+      publishedHashes.erase(change.before.directory);
+    }
+    if (change.fields & (APP_DIRECTORY | APP_STYLE | APP_MINIFY))
+      publish_style(change.after.directory);
+  }
+}
+
+void Watcher::publish_style(const std::string& directory) {
+  Application app;
+  try {
+    app = gConfig->get_application_by_directory(directory);
+  } catch (const std::exception&) {
+    // shared partials nobody imports yet
+    return;
+  }
+  auto style = app.get_style();
+
+  auto hash = util::hash(style);
+  auto published = publishedHashes.find(directory);
+  if (published != publishedHashes.end() && published->second == hash) {
+    ++suppressedDuplicates;
+  } else if (gService != nullptr && gService->server != nullptr) {
+    publishedHashes[directory] = hash;
+    gService->server->update_style(app.name, style);
+  }
+}
+
+Watcher::FileState Watcher::file_state(const std::filesystem::path& path) {
+  FileState state;
+  std::error_code ec;
+  state.size = std::filesystem::file_size(path, ec);
+  if (ec) return state;
+  state.writeTime = std::filesystem::last_write_time(path, ec);
+  if (ec) return state;
+  state.exists = true;
+  return state;
+}
+
+std::filesystem::path Watcher::watched_file(const std::string& key) {
+  if (key == CONFIG_KEY) return gConfig->config_file;
+  return key;
+}
@@ -3,13 +3,38 @@
 
 #include <efsw/efsw.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
 #include "config.hpp"
 
+typedef struct watcher_stats_t {
+  // events efsw reported for the config and styles
+  uint64_t rawEvents;
+  // times a file was read after its writes settled
+  uint64_t coalescedEvents;
+  // reads that found the content unchanged and weren't published
+  uint64_t suppressedDuplicates;
+} WatcherStats;
+
+// Turns efsw's raw events into one read per save. Events are collected per
+// file until nothing has happened for the quiet window and the file has
+// stopped changing, then the applications whose bundled stylesheet includes
+// the file are rebuilt once and only published if their content hash differs
+// from what was last published.
 class Watcher : public efsw::FileWatchListener {
  public:
   Watcher();
+  ~Watcher();
 
   void start();
+  WatcherStats stats() const;
 
   // efsw::FileWatchListener
   void handleFileAction(efsw::WatchID watchId, const std::string& dir,
@@ -17,8 +42,49 @@ class Watcher : public efsw::FileWatchListener {
                         std::string oldFilename) override;
 
  private:
+  typedef struct file_state_t {
+    bool exists = false;
+    uintmax_t size = 0;
+    std::filesystem::file_time_type writeTime;
+
+    bool operator==(const file_state_t&) const = default;
+  } FileState;
+
+  typedef struct pending_t {
+    std::chrono::steady_clock::time_point due;
+    // of the file at the last event, it has settled once this stops changing
+    FileState state;
+    // the application directory the file is in, rebuilt if no bundle
+    // includes the file (yet)
+    std::string styleDir;
+  } Pending;
+
   efsw::FileWatcher* watcher;
   efsw::WatchID watcherId;
+
+  std::mutex m;
+  std::condition_variable c;
+  bool stopping = false;
+  // keyed by file path, or CONFIG_KEY
+  std::unordered_map<std::string, Pending> pending;
+  std::thread flusher;
+
+  // flusher thread only, keyed by application directory
+  std::unordered_map<std::string, uint64_t> publishedHashes;
+
+  std::atomic<uint64_t> rawEvents = 0;
+  std::atomic<uint64_t> coalescedEvents = 0;
+  std::atomic<uint64_t> suppressedDuplicates = 0;
+
+  void schedule(const std::string& key, const std::string& styleDir = {});
+  void flush_loop();
+  // false if the file isn't ready to be read yet
+  bool flush(const std::string& key, const Pending& item);
+  void apply(const ConfigDiff& diff);
+  void publish_style(const std::string& directory);
+
+  static FileState file_state(const std::filesystem::path& path);
+  static std::filesystem::path watched_file(const std::string& key);
 };
 
 extern std::unique_ptr<Watcher> gWatcher;
@@ -0,0 +1,92 @@
+// @import handling of StyleBundler on stylesheets written to a temporary
+// config directory. Exits non-zero on the first failure.
+
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "../src/config.hpp"
+#include "../src/filecache.hpp"
+#include "../src/stylebundler.hpp"
+
+namespace {
+  int failures = 0;
+
+  void expect(bool ok, std::string_view what, const std::string& bundle) {
+    if (ok) return;
+    fprintf(stderr, "FAIL: %.*s\n--- bundle ---\n%s\n--------------\n",
+            static_cast<int>(what.size()), what.data(), bundle.c_str());
+    ++failures;
+  }
+
+  size_t count(const std::string& s, std::string_view what) {
+    size_t n = 0;
+    for (auto at = s.find(what); at != std::string::npos;
+         at = s.find(what, at + 1))
+      ++n;
+    return n;
+  }
+
+  // the bundle of an application whose index.css is css, with a.css next to
+  // it
+  std::string bundle(const std::string& css) {
+    auto dir = gConfig->styles_directory / "app";
+    std::ofstream(dir / "index.css", std::ios::binary) << css;
+    gFileCache->invalidate(dir / "index.css");
+    gBundler->invalidate(dir / "index.css");
+    return gBundler->bundle(gConfig->get_application_by_directory("app"));
+  }
+}  // namespace
+
+int main() {
+  auto dir = std::filesystem::temp_directory_path() /
+             std::format("electrotheme-bundler-test-{:08x}",
+                         std::random_device{}());
+  std::filesystem::create_directories(dir);
+  std::ofstream(dir / "config.json")
+      << nlohmann::json(
+             {{"logLevel", "error"},
+              {"applications", {{{"name", "app"}, {"directory", "app"}}}}})
+             .dump();
+  auto dirString = dir.string();
+  gConfig = std::make_unique<Config>();
+  gConfig->set_config_directory(dirString);
+  gConfig->load_file(true);
+  gFileCache = std::make_unique<FileCache>();
+  gBundler = std::make_unique<StyleBundler>();
+  std::ofstream(gConfig->styles_directory / "app" / "a.css") << ".a{}";
+
+  {
+    auto out = bundle("@import \"a.css\" supports(display:grid) screen;\n");
+    expect(out.find("@supports (display:grid) {") != std::string::npos &&
+               out.find("@media screen {") != std::string::npos &&
+               count(out, "{") == count(out, "}"),
+           "supports() and media wrap the import", out);
+  }
+  {
+    auto out = bundle("@import \"a.css\" supports(display:grid;\n.b{}\n");
+    expect(out.find(".a{}") != std::string::npos &&
+               out.find("@supports") == std::string::npos &&
+               out.find("@media") == std::string::npos &&
+               count(out, "{") == count(out, "}"),
+           "an unclosed supports( imports without conditions", out);
+  }
+  {
+    auto out = bundle("@import \"a.css\" layer(base screen;\n.b{}\n");
+    expect(out.find(".a{}") != std::string::npos &&
+               out.find("@layer") == std::string::npos &&
+               out.find("@media") == std::string::npos &&
+               count(out, "{") == count(out, "}"),
+           "an unclosed layer( imports without conditions", out);
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  if (failures == 0) printf("stylebundler_test: all passed\n");
+  return failures == 0 ? 0 : 1;
+}